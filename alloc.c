@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CONSTATUS_INTERNAL
+#include "constatus.h"
+
+/*
+ * memory handed out by cmod_alloc() and friends is charged to a pool: that of
+ * the gadget whose context it was allocated in, or a pool of its own for
+ * anything allocated outside of one. each block starts with a header putting
+ * it on its pool's list, so that the pool knows how much it holds, and so
+ * that a gadget's memory can all be freed at once when it goes away, whether
+ * or not the module remembered to.
+ *
+ * only to be used from the main thread (or an isolated gadget's host), like
+ * the rest of the cmod_*() functions.
+ */
+
+union alloc_header {
+	struct {
+		struct list list;
+		struct alloc_pool *pool;
+		size_t size;
+	} h;
+	// keep what follows suitably aligned for anything
+	max_align_t align;
+};
+
+// for allocations made outside of any gadget's context
+static struct alloc_pool unowned_pool = {
+	{ &unowned_pool.blocks, &unowned_pool.blocks, },
+};
+
+void pool_init(struct alloc_pool *pool) {
+	memset(pool, 0, sizeof(*pool));
+	list_init(&pool->blocks);
+}
+
+static struct alloc_pool *current_pool(void) {
+	struct gadget *g = get_gadget_context();
+
+	return g ? &g->pool : &unowned_pool;
+}
+
+static void charge(struct alloc_pool *pool, union alloc_header *hdr) {
+	list_append(&pool->blocks, &hdr->h.list);
+	hdr->h.pool = pool;
+
+	pool->bytes += hdr->h.size;
+	++pool->n_blocks;
+	if (pool->bytes > pool->peak)
+		pool->peak = pool->bytes;
+	stats.gadget_bytes += hdr->h.size;
+}
+
+static void uncharge(union alloc_header *hdr) {
+	struct alloc_pool *pool = hdr->h.pool;
+
+	list_del(&hdr->h.list);
+	pool->bytes -= hdr->h.size;
+	--pool->n_blocks;
+	stats.gadget_bytes -= hdr->h.size;
+}
+
+void *cmod_alloc(size_t size) {
+	union alloc_header *hdr;
+
+	if (size > SIZE_MAX - sizeof(*hdr) ||
+	    !(hdr = malloc(sizeof(*hdr) + size)))
+		return NULL;
+
+	hdr->h.size = size;
+	charge(current_pool(), hdr);
+
+	return hdr + 1;
+}
+
+void *cmod_calloc(size_t n, size_t size) {
+	void *ret;
+
+	if (size && n > SIZE_MAX / size)
+		return NULL;
+
+	if ((ret = cmod_alloc(n * size)))
+		memset(ret, 0, n * size);
+
+	return ret;
+}
+
+// the block stays in the pool it was first allocated from
+void *cmod_realloc(void *p, size_t size) {
+	union alloc_header *hdr, *tmp;
+	struct alloc_pool *pool;
+
+	if (!p)
+		return cmod_alloc(size);
+
+	if (size > SIZE_MAX - sizeof(*hdr))
+		return NULL;
+
+	hdr = (union alloc_header *)p - 1;
+	pool = hdr->h.pool;
+
+	// realloc() may move the block, which would leave the list pointing
+	// at where it used to be
+	uncharge(hdr);
+	if (!(tmp = realloc(hdr, sizeof(*hdr) + size))) {
+		charge(pool, hdr);
+		return NULL;
+	}
+
+	tmp->h.size = size;
+	charge(pool, tmp);
+
+	return tmp + 1;
+}
+
+void cmod_free(void *p) {
+	union alloc_header *hdr;
+
+	if (!p)
+		return;
+
+	hdr = (union alloc_header *)p - 1;
+	uncharge(hdr);
+	free(hdr);
+}
+
+char *cmod_strdup(const char *s) {
+	size_t len = strlen(s) + 1;
+	char *ret;
+
+	if ((ret = cmod_alloc(len)))
+		memcpy(ret, s, len);
+
+	return ret;
+}
+
+// free everything left in a pool, all at once
+void pool_release(struct alloc_pool *pool) {
+	union alloc_header *hdr, *next;
+
+	LIST_FOR_EACH_DELETE(&pool->blocks, hdr, next, union alloc_header,
+			     h.list) {
+		stats.gadget_bytes -= hdr->h.size;
+		free(hdr);
+	}
+
+	list_init(&pool->blocks);
+	pool->bytes = 0;
+	pool->n_blocks = 0;
+}
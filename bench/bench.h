@@ -0,0 +1,83 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// a little harness shared by the benchmarks. each result is a line on
+// stdout: a table for people by default, or with -j a JSON object, so that
+// runs can be saved and compared between releases.
+//
+// allocations are counted by having the linker route malloc() and friends
+// through the wrappers below (see BENCH_LDFLAGS in the Makefile).
+
+// roughly how long each case is run for
+#define BENCH_MIN_NANOS			200000000LL
+
+static int bench_json = 0;
+unsigned long bench_allocs = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size) {
+	++bench_allocs;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+	++bench_allocs;
+	return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+	++bench_allocs;
+	return __real_realloc(p, size);
+}
+
+static inline void bench_init(int argc, char **argv) {
+	int i;
+
+	for (i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-j") == 0) {
+			bench_json = 1;
+		} else {
+			fprintf(stderr, "usage: %s [-j]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+static inline long long bench_now(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// report ops operations on something of the given size, which took nanos
+// nanoseconds and made allocs allocations
+static inline void bench_report(const char *name, long size,
+				unsigned long ops, long long nanos,
+				unsigned long allocs) {
+	double ns_per_op = ops ? (double)nanos / ops : 0;
+	double ops_per_sec = nanos ? ops * 1e9 / nanos : 0;
+	double allocs_per_op = ops ? (double)allocs / ops : 0;
+
+	if (bench_json)
+		printf("{\"name\":\"%s\",\"size\":%ld,\"ops\":%lu,"
+		       "\"ns_per_op\":%.1f,\"ops_per_sec\":%.0f,"
+		       "\"allocs_per_op\":%.4f}\n",
+		       name, size, ops, ns_per_op, ops_per_sec,
+		       allocs_per_op);
+	else
+		printf("%-20s %7ld %11.0f ops/s %10.1f ns/op %9.4f allocs/op\n",
+		       name, size, ops_per_sec, ns_per_op, allocs_per_op);
+	fflush(stdout);
+}
+
+#endif /* _BENCH_H_ */
@@ -0,0 +1,280 @@
+// the core's data structures, from 10 to 100,000 gadgets: the wakeup heap, the
+// list helpers, layout, and the message store
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "bench.h"
+#define CONSTATUS_INTERNAL
+#include "constatus.h"
+
+static const long sizes[] = { 10, 100, 1000, 10000, 100000, };
+#define N_SIZES				(sizeof(sizes) / sizeof(*sizes))
+
+// layout.c and messages.c expect these from the rest of the core
+struct constatus_stats stats;
+int isolate_host_active = 0;
+
+void isolate_host_message(const char *key, const char *fmt, va_list args,
+			  enum message_type type) {
+}
+
+void msglog_append(enum message_type type, struct timespec *time,
+		   const char *text, size_t len) {
+}
+
+// something to keep results alive, so the compiler can't drop the work
+static unsigned long sink;
+
+static struct timespec nanos_to_ts(long long nanos) {
+	struct timespec ts = {
+		.tv_sec = nanos / 1000000000,
+		.tv_nsec = nanos % 1000000000,
+	};
+
+	return ts;
+}
+
+// keep calling fn on ctx until it has run for long enough; fn returns the
+// number of operations it did
+static void run(const char *name, long size, unsigned long (*fn)(void *),
+		void *ctx) {
+	unsigned long ops = 0, allocs = bench_allocs;
+	long long start = bench_now(), elapsed;
+
+	do {
+		ops += fn(ctx);
+		elapsed = bench_now() - start;
+	} while (elapsed < BENCH_MIN_NANOS);
+
+	bench_report(name, size, ops, elapsed, bench_allocs - allocs);
+}
+
+// a heap of wakeups spread over a second, as if every gadget had just been
+// scheduled
+static void fill_heap(struct wakeup_heap *h, long size) {
+	struct wakeup w = { .gadget = NULL, };
+	long i;
+
+	for (i = 0; i < size; ++i) {
+		w.time = nanos_to_ts(rand() % 1000000000);
+		if (queue_wakeup(h, &w))
+			abort();
+	}
+}
+
+struct heap_ctx {
+	struct wakeup_heap heap;
+	long size;
+};
+
+// what the main loop does: take the soonest wakeup, and put it back a
+// period later
+static unsigned long bench_reschedule(void *arg) {
+	struct heap_ctx *ctx = arg;
+	struct wakeup w;
+	long long t;
+	int i;
+
+	for (i = 0; i < 1000; ++i) {
+		pop_next_wakeup(&ctx->heap, &w);
+		t = w.time.tv_sec * 1000000000LL + w.time.tv_nsec;
+		w.time = nanos_to_ts(t + 1 + rand() % 1000000000);
+		queue_wakeup(&ctx->heap, &w);
+	}
+
+	return i;
+}
+
+// building a heap from nothing and emptying it again, as at startup
+static unsigned long bench_fill(void *arg) {
+	struct heap_ctx *ctx = arg;
+	struct wakeup w;
+	struct wakeup_heap heap = { NULL, 0, 0, };
+
+	fill_heap(&heap, ctx->size);
+	while (pop_next_wakeup(&heap, &w) == 0)
+		sink += w.time.tv_nsec;
+	free_wakeups(&heap);
+
+	return ctx->size * 2;
+}
+
+struct node {
+	struct list list;
+	long value;
+};
+
+struct list_ctx {
+	struct list head;
+	struct node *nodes;
+	long size;
+};
+
+// moving things to the back of a list, as pages and exec waiters do
+static unsigned long bench_list_move(void *arg) {
+	struct list_ctx *ctx = arg;
+	struct node *n;
+	int i;
+
+	for (i = 0; i < 1000; ++i) {
+		n = &ctx->nodes[rand() % ctx->size];
+		list_del(&n->list);
+		list_append(&ctx->head, &n->list);
+	}
+
+	return i;
+}
+
+static unsigned long bench_list_walk(void *arg) {
+	struct list_ctx *ctx = arg;
+	struct node *n;
+
+	LIST_FOR_EACH(&ctx->head, n, struct node, list)
+		sink += n->value;
+
+	return ctx->size;
+}
+
+struct layout_ctx {
+	struct gadget **gadgets;
+	long size;
+};
+
+static unsigned long bench_layout(void *arg) {
+	struct layout_ctx *ctx = arg;
+
+	layout_forget();
+	if (layout_gadgets(ctx->gadgets, ctx->size, 50, 200) < 0)
+		abort();
+
+	return ctx->size;
+}
+
+// the same layout, over and over, as on every cmod_resize() that doesn't
+// actually change anything
+static unsigned long bench_layout_cached(void *arg) {
+	struct layout_ctx *ctx = arg;
+
+	if (layout_gadgets(ctx->gadgets, ctx->size, 50, 200) < 0)
+		abort();
+
+	return ctx->size;
+}
+
+struct message_ctx {
+	char (*keys)[48];
+	long size;
+};
+
+// the key is also the message, which has nothing to format
+static void log_key(const char *key, ...) {
+	va_list args;
+
+	va_start(args, key);
+	log_gadget_message(NULL, key, key, args, MSGTYPE_INFO);
+	va_end(args);
+}
+
+static unsigned long bench_messages_new(void *arg) {
+	struct message_ctx *ctx = arg;
+	long i;
+
+	free_messages();
+	for (i = 0; i < ctx->size; ++i)
+		log_key(ctx->keys[i]);
+
+	return ctx->size;
+}
+
+// the same messages logged over and over, as a gadget stuck in an error
+// state would
+static unsigned long bench_messages_repeat(void *arg) {
+	struct message_ctx *ctx = arg;
+	int i;
+
+	for (i = 0; i < 1000; ++i)
+		log_key(ctx->keys[rand() % ctx->size]);
+
+	return i;
+}
+
+int main(int argc, char **argv) {
+	struct heap_ctx heap_ctx;
+	struct list_ctx list_ctx;
+	struct layout_ctx layout_ctx;
+	struct message_ctx message_ctx;
+	struct gadget *gadgets;
+	size_t i;
+	long j;
+
+	bench_init(argc, argv);
+	srand(1);
+
+	// no rate limiting, or only the first few messages would be stored
+	message_limits.rate = 0;
+
+	for (i = 0; i < N_SIZES; ++i) {
+		memset(&heap_ctx, 0, sizeof(heap_ctx));
+		heap_ctx.size = sizes[i];
+		fill_heap(&heap_ctx.heap, sizes[i]);
+		run("heap_reschedule", sizes[i], bench_reschedule, &heap_ctx);
+		run("heap_fill_drain", sizes[i], bench_fill, &heap_ctx);
+		free_wakeups(&heap_ctx.heap);
+	}
+
+	for (i = 0; i < N_SIZES; ++i) {
+		list_ctx.size = sizes[i];
+		if (!(list_ctx.nodes = calloc(sizes[i],
+					      sizeof(*list_ctx.nodes))))
+			abort();
+		list_init(&list_ctx.head);
+		for (j = 0; j < sizes[i]; ++j) {
+			list_ctx.nodes[j].value = j;
+			list_append(&list_ctx.head, &list_ctx.nodes[j].list);
+		}
+		run("list_move", sizes[i], bench_list_move, &list_ctx);
+		run("list_walk", sizes[i], bench_list_walk, &list_ctx);
+		free(list_ctx.nodes);
+	}
+
+	for (i = 0; i < N_SIZES; ++i) {
+		layout_ctx.size = sizes[i];
+		if (!(gadgets = calloc(sizes[i], sizeof(*gadgets))) ||
+		    !(layout_ctx.gadgets = calloc(sizes[i],
+						  sizeof(*layout_ctx.gadgets))))
+			abort();
+		for (j = 0; j < sizes[i]; ++j) {
+			gadgets[j].height = 1 + rand() % 8;
+			gadgets[j].width = 10 + rand() % 30;
+			layout_ctx.gadgets[j] = &gadgets[j];
+		}
+		run("layout", sizes[i], bench_layout, &layout_ctx);
+		run("layout_cached", sizes[i], bench_layout_cached,
+		    &layout_ctx);
+		layout_forget();
+		free(layout_ctx.gadgets);
+		free(gadgets);
+	}
+
+	for (i = 0; i < N_SIZES; ++i) {
+		message_ctx.size = sizes[i];
+		if (!(message_ctx.keys = calloc(sizes[i],
+						sizeof(*message_ctx.keys))))
+			abort();
+		for (j = 0; j < sizes[i]; ++j)
+			snprintf(message_ctx.keys[j],
+				 sizeof(message_ctx.keys[j]),
+				 "something went wrong %ld", j);
+		run("messages_new", sizes[i], bench_messages_new,
+		    &message_ctx);
+		run("messages_repeat", sizes[i], bench_messages_repeat,
+		    &message_ctx);
+		free_messages();
+		free(message_ctx.keys);
+	}
+
+	return (sink == 42) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,63 @@
+// how long it takes to parse the cpu lines of /proc/stat on a big machine
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bench.h"
+#include "cpu_stat.h"
+
+#define N_CORES				256
+#define ITERATIONS			100000
+
+// something shaped like /proc/stat on a busy 256 core machine, with the
+// kind of numbers you get after a few weeks of uptime
+static size_t make_stat(char *buf, size_t size) {
+	size_t len;
+	int i;
+
+	len = snprintf(buf, size, "cpu  %d %d %d %d %d %d %d %d 0 0\n",
+		       1234567890, 12345, 234567890, 1987654321, 345678,
+		       0, 456789, 0);
+	for (i = 0; i < N_CORES; ++i)
+		len += snprintf(buf + len, size - len,
+				"cpu%d %d %d %d %d %d %d %d %d 0 0\n",
+				i, 4823000 + i, 48, 916000 + i, 7764000 + i,
+				1350, 0, 1780 + i, 0);
+	len += snprintf(buf + len, size - len, "intr 98436 0 0 0 0\n");
+
+	return len;
+}
+
+int main(int argc, char **argv) {
+	static char buf[N_CORES * 128];
+	static struct cpu_times cores[N_CORES];
+	struct cpu_times all;
+	size_t len = make_stat(buf, sizeof(buf));
+	unsigned long long check = 0;
+	unsigned long allocs;
+	long long start;
+	int i;
+
+	bench_init(argc, argv);
+
+	if (cpu_stat_parse(buf, len, &all, cores, N_CORES) != N_CORES) {
+		fprintf(stderr, "cpu_stat: parse failed\n");
+		return EXIT_FAILURE;
+	}
+
+	allocs = bench_allocs;
+	start = bench_now();
+	for (i = 0; i < ITERATIONS; ++i) {
+		cpu_stat_parse(buf, len, &all, cores, N_CORES);
+		check += cores[i % N_CORES].busy;
+	}
+	bench_report("cpu_stat_parse", N_CORES, ITERATIONS, bench_now() - start,
+		     bench_allocs - allocs);
+
+	// keep the loop from being optimised away
+	if (check == 0)
+		return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,43 @@
+#include <string.h>
+
+#define CONSTATUS_INTERNAL
+#include "constatus.h"
+
+/*
+ * the modules that are linked into the binary, rather than loaded from a
+ * module directory. the Makefile builds each of those listed in BUILTIN_MODS
+ * with CONSTATUS_BUILTIN set to its name (which renames its module table),
+ * and defines CONSTATUS_BUILTINS(X) as X(name) for each of them.
+ */
+
+#ifndef CONSTATUS_BUILTINS
+#define CONSTATUS_BUILTINS(X)
+#endif
+
+struct builtin_module {
+	const char *name;
+	struct constatus_module *module;
+};
+
+#define X(name)		extern struct constatus_module \
+				CONSTATUS_BUILTIN_TABLE(name);
+CONSTATUS_BUILTINS(X)
+#undef X
+
+#define X(name)		{ #name, &CONSTATUS_BUILTIN_TABLE(name), },
+static const struct builtin_module builtins[] = {
+	CONSTATUS_BUILTINS(X)
+	{ NULL, NULL, },
+};
+#undef X
+
+// the named module's table, if it's built in; NULL otherwise
+struct constatus_module *find_builtin_module(const char *name) {
+	const struct builtin_module *b;
+
+	for (b = builtins; b->name; ++b)
+		if (strcmp(b->name, name) == 0)
+			return b->module;
+
+	return NULL;
+}
@@ -0,0 +1,87 @@
+#include <time.h>
+
+#define CONSTATUS_INTERNAL
+#include "constatus.h"
+
+/*
+ * everything that cares what time it is (the core, built in gadgets, and
+ * modules by way of cmod_gettime()) asks here rather than calling
+ * clock_gettime() itself. normally that's all this does, but when simulating
+ * the monotonic clock is virtual: it only moves when the main loop advances
+ * it to the next deadline, so that a month of running can be had in minutes.
+ * the wall and boot time clocks keep a fixed offset from it, as they would on
+ * a machine that was never suspended and whose clock was never stepped.
+ */
+
+int simulating = 0;
+// the virtual CLOCK_MONOTONIC, and the other clocks' offsets from it, all in
+// nanoseconds
+static long long sim_now;
+static long long sim_realtime_offset;
+static long long sim_boottime_offset;
+
+static long long to_nanos(struct timespec *ts) {
+	return ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+static struct timespec from_nanos(long long nanos) {
+	struct timespec ts = {
+		.tv_sec = nanos / 1000000000,
+		.tv_nsec = nanos % 1000000000,
+	};
+
+	return ts;
+}
+
+// switch over to virtual time, starting from the real time now
+int simulate_start(void) {
+	struct timespec mono, wall, boot;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &mono) ||
+	    clock_gettime(CLOCK_REALTIME, &wall))
+		return -1;
+
+	sim_now = to_nanos(&mono);
+	sim_realtime_offset = to_nanos(&wall) - sim_now;
+	sim_boottime_offset = 0;
+#ifdef CLOCK_BOOTTIME
+	if (clock_gettime(CLOCK_BOOTTIME, &boot) == 0)
+		sim_boottime_offset = to_nanos(&boot) - sim_now;
+#endif
+	simulating = 1;
+
+	return 0;
+}
+
+// move virtual time forward to the given (monotonic) time. it never goes
+// backwards.
+void simulate_advance(struct timespec *to) {
+	long long t = to_nanos(to);
+
+	if (t > sim_now)
+		sim_now = t;
+}
+
+int constatus_gettime(clockid_t clock, struct timespec *ts) {
+	if (!simulating)
+		return clock_gettime(clock, ts);
+
+	switch (clock) {
+	case CLOCK_MONOTONIC:
+		*ts = from_nanos(sim_now);
+	break;
+	case CLOCK_REALTIME:
+		*ts = from_nanos(sim_now + sim_realtime_offset);
+	break;
+#ifdef CLOCK_BOOTTIME
+	case CLOCK_BOOTTIME:
+		*ts = from_nanos(sim_now + sim_boottime_offset);
+	break;
+#endif
+	default:
+		// cpu time clocks and the like are real even in a simulation
+		return clock_gettime(clock, ts);
+	}
+
+	return 0;
+}
@@ -1,12 +1,12 @@
-
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <curses.h>
 #include <panel.h>
 #include <err.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
-#include <math.h>
 #include <time.h>
 #include <errno.h>
 #include <dlfcn.h>
@@ -14,8 +14,16 @@
 #include <poll.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <ctype.h>
+#include <signal.h>
+#include <setjmp.h>
 
 #include <libconfig.h>
 
@@ -34,11 +42,25 @@
 #define BANNER_TEXT			"constatus q:quit"
 #define SYSTEM_MODULE_DIR		"/usr/lib/constatus/modules"
 #define SYSTEM_CONF_DIR			"/etc"
+// the user's module directory and the system one, or just --module-dir
+#define N_MODULE_DIRS			2
 #define CONF_NAME			"constatus.rc"
-
-struct wakeup {
-	struct timespec time;
-	struct gadget *gadget;
+#define DEFAULT_MAX_FPS			30
+// how long to gather up resize events before acting on them
+#define DEFAULT_RESIZE_DEBOUNCE_NS	50000000
+#define DEFAULT_CALLBACK_BUDGET_NS	20000000
+#define DEFAULT_CATCHUP_LIMIT		3
+// how long a module file has to be left alone before it's reloaded
+#define RELOAD_DELAY_NS			250000000
+// how many samples a simulation prints over its run
+#define SIM_SAMPLES			100
+
+// a file descriptor the main loop polls on behalf of someone else
+struct fd_watch {
+	int fd;
+	short events;
+	fd_watch_func handler;
+	void *data;
 };
 
 enum {
@@ -48,36 +70,130 @@ enum {
 };
 
 int screen_height, screen_width;
-static struct gadget *gadgets = NULL;
+static struct gadget **gadgets = NULL;
 static size_t n_gadgets = 0;
 static struct page *cur_page = NULL;
 static struct list pages;
-static struct wakeup *wakeups = NULL;
-static size_t n_wakeups = 0;
-static size_t wakeups_size = 0;
+static struct wakeup_heap wakeups;
+// CLOCK_REALTIME - CLOCK_MONOTONIC in nanoseconds, as of the last time we
+// checked. used to turn wall-clock aligned deadlines into monotonic ones.
+static long long realtime_offset;
+// CLOCK_BOOTTIME - CLOCK_MONOTONIC, likewise. the two only drift apart while
+// the machine is suspended.
+static long long boottime_offset = -1;
+static struct fd_watch *watches = NULL;
+static size_t n_watches = 0;
+static struct pollfd *pollfds = NULL;
 static int curses_active = 0;
 static char *home_dir = NULL;
 static char *conf_file = NULL;
 static char *module_dir = NULL;
+static char log_file_buf[_POSIX_PATH_MAX+1];
 // for the benefit of cmod_*() functions so that they can tell what gadget
 // they're being called from
 struct gadget *current_gadget;
 // used by things like cmod_resize() to signal that the screen needs a redraw
 int need_redraw = 0;
-static struct message **messages = NULL;
-static size_t n_messages = 0;
-static size_t message_errors = 0;
-static int error_flag = 0;
-
-static int cleanup(void) {
-	if (curses_active && endwin() == ERR) {
+// set whenever something visible has changed since the screen was last
+// flushed to the terminal
+static int screen_dirty = 0;
+// the screen is flushed at most max_fps times per second, except in response to
+// input. -1 means it hasn't been configured; 0 means no limit.
+static int max_fps = -1;
+static struct timespec frame_interval;
+static struct timespec last_flush;
+// low bandwidth mode trades looks for fewer bytes on the wire, and holds frames
+// back to keep the output rate under output_budget bytes per second (0 means
+// work it out from the terminal's baud rate). budget_ready is when the
+// terminal will have worked off the frames sent so far.
+static int low_bandwidth = -1;
+static long output_budget = 0;
+static struct timespec budget_ready;
+// when the current output rate measurement started, and stats.bytes_written
+// at the time
+static struct timespec rate_window_start;
+static unsigned long rate_window_bytes;
+// /proc/thread-self/io, which is how we find out how much curses has written
+static int thread_io_fd = -1;
+static attr_t banner_attrs, error_attrs;
+struct constatus_stats stats;
+// print stats on the way out
+static int dump_stats = 0;
+// set by SIGUSR1, which asks for the stats to be logged
+static volatile sig_atomic_t stats_requested = 0;
+// where to write traces, or NULL if not tracing; SIGUSR2 asks for one
+static char *trace_file = NULL;
+static char trace_file_buf[_POSIX_PATH_MAX+1];
+static volatile sig_atomic_t trace_requested = 0;
+// SIGWINCH is taken from a signalfd rather than left to curses, so that a
+// burst of resizes (from dragging a window around) can be handled in one go:
+// the first one starts the clock, and once resize_debounce has passed the
+// screen is laid out for whatever size it has ended up. winch_fd is -1 if
+// curses is handling resizes itself.
+static int winch_fd = -1;
+static int resize_pending = 0;
+static struct timespec resize_due;
+static struct timespec resize_debounce = {
+	.tv_sec = 0,
+	.tv_nsec = DEFAULT_RESIZE_DEBOUNCE_NS,
+};
+int layout_deferred = 0;
+// how long due callbacks may run for before input gets another look in
+static struct timespec callback_budget = {
+	.tv_sec = 0,
+	.tv_nsec = DEFAULT_CALLBACK_BUDGET_NS,
+};
+// set while nobody can see the screen: our process group isn't in the
+// foreground of the terminal. nothing is drawn or flushed, and only gadgets
+// that keep_sampling are run. hangup is set by SIGHUP.
+static int idle = 0;
+static volatile sig_atomic_t hangup = 0;
+// when simulating (--simulate), how much virtual time to run for, and how
+// often to print a sample of how things are going. the screen is a null
+// terminal, and there's no input.
+static long long sim_duration = 0;
+static struct timespec sim_end, sim_sample_interval, sim_next_sample;
+static struct timespec sim_start;
+// the module directories and the config file's directory are watched with
+// inotify. gadgets whose module has changed, and the config file, are
+// reloaded once nothing has been written to them for reload_delay, since a
+// build or an editor may write them more than once. file_watch_fd is -1 if
+// nothing is being watched, and conf_wd if the config file isn't.
+static int file_watch_fd = -1;
+static int conf_wd = -1;
+static int reload_pending = 0;
+static int conf_changed = 0;
+static struct timespec reload_due;
+static struct timespec reload_delay = {
+	.tv_sec = 0,
+	.tv_nsec = RELOAD_DELAY_NS,
+};
+// set while the config file is being reloaded, so that a mistake in it
+// abandons the reload (by way of reload_env) rather than exiting
+static int conf_reloading = 0;
+static jmp_buf reload_env;
+
+// put the terminal back the way it was
+static int leave_curses(void) {
+	// the null terminal can't be put back the way it was, and needn't be
+	if (curses_active && endwin() == ERR && !simulating) {
 		warnx("error leaving curses mode; screen may be corrupt");
 		return EXIT_FAILURE;
 	}
 
-	// [TODO] [XXX] find a better way of conveying these to the user
-	for (int i = 0; i < n_messages; ++i)
-		printf("%s\n", messages[i]->text);
+	return EXIT_SUCCESS;
+}
+
+static int cleanup(void) {
+	msglog_stop();
+
+	if (leave_curses())
+		return EXIT_FAILURE;
+
+	print_messages(stdout);
+	if (dump_stats)
+		print_stats(stdout);
+	free_messages();
 
 	return EXIT_SUCCESS;
 }
@@ -102,85 +218,51 @@ static void panicx(const char *fmt, ...) {
 	verrx(EXIT_FAILURE, fmt, args);
 }
 
-void log_message(const char *fmt, va_list args, enum message_type type) {
-	void *tmp;
-	int text_len;
-	struct timespec time;
-	struct message *msg;
-
-	if (!(tmp = realloc(messages, (n_messages + 1) * sizeof(*messages))))
-		goto err;
-	messages = tmp;
-
-	if ((text_len = vsnprintf(NULL, 0, fmt, args)) < 0)
-		goto err;
-
-	if (clock_gettime(CLOCK_REALTIME, &time))
-		goto err;
-
-	if (!(msg = malloc(sizeof(*msg) + text_len + 1)))
-		goto err;
-
-	msg->type = type;
-	msg->len = text_len;
-	msg->time = time;
-	vsnprintf(msg->text, text_len+1, fmt, args);
-
-	messages[n_messages++] = msg;
-
-	if (type == MSGTYPE_ERROR)
-		error_flag = 1;
-
-	return;
-
-   err:
-	++message_errors;
-	error_flag = 1;
-}
-
-void constatus_vmsg(const char *fmt, va_list args, enum message_type type) {
-	log_message(fmt, args, type);
-}
-
-void constatus_verr(const char *fmt, va_list args) {
-	log_message(fmt, args, MSGTYPE_ERROR);
-}
-
-void constatus_vinfo(const char *fmt, va_list args) {
-	log_message(fmt, args, MSGTYPE_INFO);
-}
-
-void constatus_msg(const char *fmt, enum message_type type, ...) {
-	va_list args;
-
-	va_start(args, type);
-
-	log_message(fmt, args, type);
-
+// give up on reloading the config file, leaving things as they were
+static void abandon_reload(const char *fmt, va_list args) {
+	constatus_verr(fmt, args);
 	va_end(args);
+
+	longjmp(reload_env, 1);
 }
 
-void constatus_err(const char *fmt, ...) {
+// a mistake in the config file: fatal at startup, but only the end of the
+// reload when the file is being reloaded
+static void conf_error(const char *fmt, ...) {
 	va_list args;
 
 	va_start(args, fmt);
 
-	log_message(fmt, args, MSGTYPE_ERROR);
+	if (conf_reloading)
+		abandon_reload(fmt, args);
 
-	va_end(args);
+	verrx(EXIT_FAILURE, fmt, args);
 }
 
-void constatus_info(const char *fmt, ...) {
+// as above, for a gadget that can't be loaded
+static void load_error(const char *fmt, ...) {
 	va_list args;
 
 	va_start(args, fmt);
 
-	log_message(fmt, args, MSGTYPE_INFO);
+	if (conf_reloading)
+		abandon_reload(fmt, args);
 
-	va_end(args);
+	cleanup();
+	verrx(EXIT_FAILURE, fmt, args);
 }
 
 static void setup_color_palate(void) {
+	banner_attrs = COLOR_PAIR(COLOR_PAIR_BANNER) | A_BOLD;
+	error_attrs = COLOR_PAIR(COLOR_PAIR_ERR) | A_BOLD;
+
+	// every attribute change costs an escape sequence, so stick to one
+	if (low_bandwidth) {
+		banner_attrs = A_REVERSE;
+		error_attrs = A_REVERSE;
+		return;
+	}
+
 	if (!has_colors() || NEEDED_COLOR_PAIRS >= COLOR_PAIRS)
 		return;
 
@@ -192,11 +274,11 @@ static void setup_color_palate(void) {
 static void draw_banner() {
 	int i;
 
-	attron(COLOR_PAIR(COLOR_PAIR_BANNER) | A_BOLD);
+	attron(banner_attrs);
 	mvaddnstr(0, 0, BANNER_TEXT, screen_width);
 	for (i = const_strlen(BANNER_TEXT); i < screen_width; ++i)
 		addch(' ');
-	attroff(COLOR_PAIR(COLOR_PAIR_BANNER) | A_BOLD);
+	attroff(banner_attrs);
 }
 
 static void set_error_banner(const char *fmt, ...) {
@@ -205,37 +287,19 @@ static void set_error_banner(const char *fmt, ...) {
 	va_list args;
 
 	draw_banner();
+	screen_dirty = 1;
 
 	va_start(args, fmt);
 
 	vsnprintf(text, min(sizeof(text), screen_width+1), fmt, args);
 
-	attron(COLOR_PAIR(COLOR_PAIR_ERR) | A_BOLD);
+	attron(error_attrs);
 	mvaddstr(0, 0, text);
-	attroff(COLOR_PAIR(COLOR_PAIR_ERR) | A_BOLD);
+	attroff(error_attrs);
 
 	va_end(args);
 }
 
-static void center_gadget_row(int first, int last, int row_height, int row_width) {
-	int i;
-	int horz_shift = floor((double)(screen_width - row_width)/2.0);
-
-	for (i = first; i <= last; ++i) {
-		gadgets[i].y +=
-			ceil((double)(row_height - gadgets[i].height)/2.0);
-		gadgets[i].x += horz_shift;
-	}
-}
-
-static void center_gadget_page(int first, int last, int page_height) {
-	int i;
-	int vert_shift = floor((double)(screen_height - page_height)/2.0);
-
-	for (i = first; i <= last; ++i)
-		gadgets[i].y += vert_shift;
-}
-
 static struct page *add_page(void) {
 	struct page *ret;
 
@@ -273,6 +337,20 @@ static void clear_pages(void) {
 	cur_page = NULL;
 }
 
+// where pg comes among the pages, counting from 0; 0 if it isn't there
+static int page_index(struct page *pg) {
+	struct page *p;
+	int i = 0;
+
+	LIST_FOR_EACH(&pages, p, struct page, list) {
+		if (p == pg)
+			return i;
+		++i;
+	}
+
+	return 0;
+}
+
 static int show_page(struct page *pg) {
 	struct gadget *g;
 
@@ -297,245 +375,481 @@ static int hide_page(struct page *pg) {
 	return 0;
 }
 
-static int add_gadget(struct constatus_module *module, const char *name) {
-	void *tmp;
+// allocate a gadget for the given module, but don't initialize it
+static struct gadget *alloc_gadget(struct constatus_module *module,
+				   const char *name) {
+	struct gadget *g;
 
-	if (!module->init || !module->display || !module->callback) {
-		errno = EINVAL;
-		return -1;
-	}
+	if (!(g = calloc(1, sizeof(*g))))
+		return NULL;
+
+	g->module = module;
+	g->keep_sampling = module->keep_sampling;
+	g->catchup = module->catchup;
+	g->catchup_limit = module->catchup_limit ? module->catchup_limit :
+						   DEFAULT_CATCHUP_LIMIT;
+	g->height = module->height;
+	g->width = module->width;
+	snprintf(g->name, sizeof(g->name), "%s", name);
+	list_init(&g->list);
+	pool_init(&g->pool);
+	g->dl_fd = -1;
+
+	return g;
+}
+
+// allocate a gadget for the given module and add it to the gadget list, but
+// don't initialize it
+struct gadget *new_gadget(struct constatus_module *module,
+			  const char *name) {
+	void *tmp;
+	struct gadget *g;
 
 	if (!(tmp = realloc(gadgets, (n_gadgets+1) * sizeof(*gadgets))))
-		return -1;
+		return NULL;
 	gadgets = tmp;
 
-	memset(gadgets + n_gadgets, '\0', sizeof(*gadgets));
-	gadgets[n_gadgets].module = module;
-	gadgets[n_gadgets].height = module->height;
-	gadgets[n_gadgets].width = module->width;
-	snprintf(gadgets[n_gadgets].name, sizeof(gadgets[n_gadgets].name),
-		 "%s", name);
+	if (!(g = alloc_gadget(module, name)))
+		return NULL;
 
-	set_gadget_context(gadgets + n_gadgets);
-	gadgets[n_gadgets].instance = module->init();
-	clear_gadget_context();
+	gadgets[n_gadgets++] = g;
+	layout_forget();
 
-	if (!gadgets[n_gadgets].instance)
-		return -1;
+	return g;
+}
 
-	++n_gadgets;
+// tear a gadget down: have the module let go of whatever it holds, free what
+// it allocated, and unload it if nothing else is using it. the caller takes
+// it out of gadgets[] and lays out what's left.
+void free_gadget(struct gadget *g) {
+	void *dl_handle = g->dl_handle;
+	int dl_fd = g->dl_fd;
+
+	remove_wakeups(&wakeups, g);
+	trace_forget_gadget(g);
+
+	if (g->panel)
+		del_panel(g->panel);
+	if (g->window)
+		delwin(g->window);
+	list_del(&g->list);
+
+	// may free the module table, for the built in gadgets that have one
+	// per instance
+	if (g->module->destroy && g->instance) {
+		set_gadget_context(g);
+		g->module->destroy(g->instance);
+		clear_gadget_context();
+	}
 
-	return 0;
+	// after destroy(), which may have had something to say
+	forget_gadget_messages(g);
+
+	pool_release(&g->pool);
+	free(g->module_copy);
+	free(g->layout_group);
+	free(g->module_path);
+	free(g->conf_key);
+	free(g);
+
+	if (dl_handle)
+		dlclose(dl_handle);
+	if (dl_fd >= 0)
+		close(dl_fd);
 }
 
-void place_gadgets(void) {
-	int i;
-	int next_y = 1, next_x = 0;
-	int biggest_height = 0;
-	int row_start = 0;
-	int page_start = 0;
+// what each gadget has allocated through cmod_alloc(), one per line
+void print_gadget_memory(FILE *fh) {
+	size_t i;
 
-	clear_pages();
+	for (i = 0; i < n_gadgets; ++i)
+		fprintf(fh, "%s: %zu bytes in %lu blocks, at most %zu\n",
+			gadgets[i]->name, gadgets[i]->pool.bytes,
+			gadgets[i]->pool.n_blocks, gadgets[i]->pool.peak);
+}
 
-	for (i = 0; i < n_gadgets; ++i) {
-	  retry:
-		if (gadgets[i].width > screen_width ||
-		    gadgets[i].height > screen_height-1) {
-			set_error_banner("unable to place gadget: too large for screen");
-			goto err;
-		}
+// add a gadget for a module loaded from dl_handle, whose private copy is
+// dl_fd, and initialize it. module_copy is the module's table, if it had to
+// be copied (see find_module_table()). the gadget takes all three over, even
+// if it fails to initialize; if it can't be added at all, they're released.
+// dl_handle is NULL (and dl_fd -1) for modules built into the binary.
+static int add_gadget(struct constatus_module *module, const char *name,
+		      void *dl_handle, int dl_fd,
+		      struct constatus_module *module_copy) {
+	struct gadget *g;
 
-		if (list_is_empty(&pages) ||
-		    next_y + gadgets[i].height > screen_height)
-			goto new_page;
-		if (next_x + gadgets[i].width > screen_width) {
-			next_y += biggest_height;
-			goto new_row;
-		}
+	if (!module->init || !module->display || !module->callback) {
+		errno = EINVAL;
+		goto err_close;
+	}
+
+	if (!(g = new_gadget(module, name)))
+		goto err_close;
+	g->dl_handle = dl_handle;
+	g->dl_fd = dl_fd;
+	g->module_copy = module_copy;
 
-		gadgets[i].x = next_x;
-		gadgets[i].y = next_y;
-		list_append(&cur_page->gadgets, &(gadgets[i].list));
+	set_gadget_context(g);
+	g->instance = module->init();
+	clear_gadget_context();
 
-		next_x += gadgets[i].width + 1;
-		biggest_height = max(biggest_height, gadgets[i].height);
+	if (!g->instance)
+		return -1;
 
-		continue;
+	return 0;
 
-	  new_page:
-		if (!(cur_page = add_page()))
-			goto err;
+  err_close:
+	free(module_copy);
+	if (dl_handle) {
+		dlclose(dl_handle);
+		close(dl_fd);
+	}
 
-		center_gadget_page(page_start, i-1, next_y + biggest_height);
+	return -1;
+}
 
-		next_y = 1;
-		page_start = i;
+// lay the gadgets out again, staying on the same page if there still is one.
+// a page switched to just before a resize is kept that way.
+static void build_pages(void) {
+	struct page **page_list = NULL;
+	int i, n_pages, page = page_index(cur_page);
+
+	clear_pages();
 
-	  new_row:
-		center_gadget_row(row_start, i-1, biggest_height, next_x - 1);
+	if ((n_pages = layout_gadgets(gadgets, n_gadgets, screen_height,
+				      screen_width)) < 0) {
+		if (errno == ERANGE)
+			set_error_banner("unable to place gadget: too large for screen");
+		else
+			set_error_banner("cannot allocate memory for layout");
+		goto err;
+	}
 
-		biggest_height = 0;
-		next_x = 0;
-		row_start = i;
+	if (n_pages == 0)
+		return;
 
-		goto retry;
+	if (!(page_list = malloc(n_pages * sizeof(*page_list)))) {
+		set_error_banner("cannot allocate memory for layout");
+		goto err;
 	}
-	next_y += biggest_height;
-	center_gadget_row(row_start, i-1, biggest_height, next_x - 1);
-	center_gadget_page(page_start, i-1, next_y);
+
+	for (i = 0; i < n_pages; ++i)
+		if (!(page_list[i] = add_page())) {
+			set_error_banner("cannot allocate memory for layout");
+			goto err;
+		}
 
 	for (i = 0; i < n_gadgets; ++i) {
-		if (!(gadgets[i].window = newwin(gadgets[i].height,
-						 gadgets[i].width,
-						 gadgets[i].y,
-						 gadgets[i].x)) ||
-		    !(gadgets[i].panel = new_panel(gadgets[i].window)) ||
-		    hide_panel(gadgets[i].panel) == ERR) {
+		list_append(&page_list[gadgets[i]->layout_page]->gadgets,
+			    &gadgets[i]->list);
+
+		if (!(gadgets[i]->window = newwin(gadgets[i]->height,
+						 gadgets[i]->width,
+						 gadgets[i]->y,
+						 gadgets[i]->x)) ||
+		    !(gadgets[i]->panel = new_panel(gadgets[i]->window)) ||
+		    hide_panel(gadgets[i]->panel) == ERR) {
 			set_error_banner("cannot allocate windows for gadgets");
 			goto err;
 		}
+		gadgets[i]->rendered = 0;
 	}
 
-	cur_page = list_first(&pages, struct page, list);
+	cur_page = page_list[min(page, n_pages - 1)];
+	free(page_list);
+
 	if (show_page(cur_page))
 		goto err;
 
 	return;
 
   err:
+	free(page_list);
 	clear_pages();
 }
 
-static void draw_current_page(void) {
-	struct gadget *g = NULL;
+void place_gadgets(void) {
+	trace_begin("place_gadgets", NULL);
+	build_pages();
+	trace_end("place_gadgets", NULL);
+}
 
-	if (!cur_page)
+// FNV-1a over every cell in the gadget's window
+static int hash_gadget_window(struct gadget *g, uint32_t *res) {
+	static chtype *row = NULL;
+	static int row_size = 0;
+	void *tmp;
+	uint32_t hash = 2166136261u;
+	int y, x, cur_y, cur_x, height, width;
+
+	getmaxyx(g->window, height, width);
+	if (width + 1 > row_size) {
+		if (!(tmp = realloc(row, (width + 1) * sizeof(*row))))
+			return -1;
+		row = tmp;
+		row_size = width + 1;
+	}
+
+	getyx(g->window, cur_y, cur_x);
+	for (y = 0; y < height; ++y) {
+		mvwinchnstr(g->window, y, 0, row, width);
+		for (x = 0; x < width; ++x) {
+			hash ^= row[x];
+			hash *= 16777619u;
+		}
+	}
+	wmove(g->window, cur_y, cur_x);
+
+	*res = hash;
+
+	return 0;
+}
+
+// called after a gadget has had a chance to draw into its window. if what it
+// drew is different from last time, and is actually on screen, the screen needs
+// to be flushed.
+void note_gadget_drawn(struct gadget *g) {
+	uint32_t hash;
+
+	if (!g->window)
 		return;
 
-	LIST_FOR_EACH(&cur_page->gadgets, g, struct gadget, list) {
-		set_gadget_context(g);
-		g->module->display(g->instance, g->window);
-		clear_gadget_context();
+	// if the window can't be hashed, assume that it's changed
+	if (hash_gadget_window(g, &hash) == 0) {
+		if (hash == g->content_hash)
+			return;
+		g->content_hash = hash;
 	}
+	++g->generation;
+
+	if (g->panel && !panel_hidden(g->panel))
+		screen_dirty = 1;
 }
 
-static void redraw_screen(void) {
-	do {
-		need_redraw = 0;
+// curses does its own write(2)s straight to the terminal, so the only way to
+// find out how much it has sent is to ask the kernel how much this thread has
+// written. returns -1 if that information isn't available.
+static long long thread_bytes_written(void) {
+	char buf[256];
+	char *p;
+	ssize_t n;
 
-		clear();
-		draw_banner(screen_width);
-		draw_current_page();
-	} while (need_redraw);
-	// because draw_current_page() calls module->display() which can call
-	// cmod_resize() which means that we have to redraw the screen after
-	// it's done
+	if (thread_io_fd < 0 ||
+	    (n = pread(thread_io_fd, buf, sizeof(buf) - 1, 0)) <= 0)
+		return -1;
+	buf[n] = '\0';
+
+	if (!(p = strstr(buf, "wchar: ")))
+		return -1;
+
+	return strtoll(p + const_strlen("wchar: "), NULL, 10);
 }
 
-static void update_layout_and_draw(void) {
-	place_gadgets();
+// account for n bytes having been sent, pushing back the time at which the
+// next frame may go out. the terminal is allowed to bank up to a second's
+// worth of idle time.
+static void charge_output_budget(struct timespec *now, unsigned long n) {
+	struct timespec burst = { .tv_sec = 1, .tv_nsec = 0, };
+	struct timespec earliest = timespec_subtract(now, &burst);
+	struct timespec cost;
+	long long nanos;
 
-	redraw_screen();
+	if (output_budget <= 0)
+		return;
+
+	nanos = (long long)n * 1000000000 / output_budget;
+	cost.tv_sec = nanos / 1000000000;
+	cost.tv_nsec = nanos % 1000000000;
+
+	if (timespec_lt(&budget_ready, &earliest))
+		budget_ready = earliest;
+	budget_ready = timespec_add(&budget_ready, &cost);
 }
 
-static inline int timespec_lt(struct timespec *a, struct timespec *b) {
-	return (a->tv_sec < b->tv_sec) ?
-		1
-	: (a->tv_sec > b->tv_sec) ?
-		0
-	:
-		(a->tv_nsec < b->tv_nsec);
+// keep stats.output_rate up to date, measured over roughly one second
+static void update_output_rate(struct timespec *now) {
+	struct timespec elapsed = timespec_subtract(now, &rate_window_start);
+	long long nanos;
+
+	if (elapsed.tv_sec < 1)
+		return;
+
+	nanos = (long long)elapsed.tv_sec * 1000000000 + elapsed.tv_nsec;
+	stats.output_rate = (stats.bytes_written - rate_window_bytes) *
+			    1000000000ULL / nanos;
+
+	rate_window_start = *now;
+	rate_window_bytes = stats.bytes_written;
 }
 
-static inline int wakeup_sooner(struct wakeup *a, struct wakeup *b) {
-	return timespec_lt(&a->time, &b->time);
+// push any changes out to the terminal, if there are any
+static void flush_screen(void) {
+	long long before, after;
+
+	if (!screen_dirty) {
+		++stats.flushes_skipped;
+		return;
+	}
+
+	trace_begin("doupdate", NULL);
+	before = thread_bytes_written();
+	update_panels();
+	doupdate();
+	after = thread_bytes_written();
+	trace_end("doupdate", NULL);
+
+	// a frame that couldn't be measured isn't charged for, rather than
+	// being charged whatever the last one cost
+	stats.frame_bytes = (before >= 0 && after >= before) ?
+			    after - before : 0;
+	stats.bytes_written += stats.frame_bytes;
+
+	if (constatus_gettime(CLOCK_MONOTONIC, &last_flush))
+		panic("error getting current time");
+
+	if (low_bandwidth)
+		charge_output_budget(&last_flush, stats.frame_bytes);
+	update_output_rate(&last_flush);
+
+	screen_dirty = 0;
+	++stats.flushes;
 }
 
-static inline size_t parent_index(size_t i) {
-	return (i - 1) / 2;
+// when the next frame may be flushed. only meaningful if the screen is dirty.
+static struct timespec next_frame_time(void) {
+	struct timespec ret = timespec_add(&last_flush, &frame_interval);
+
+	if (low_bandwidth && timespec_lt(&ret, &budget_ready))
+		ret = budget_ready;
+
+	return ret;
 }
 
-static inline void wakeup_swap(struct wakeup *a, struct wakeup *b) {
-	struct wakeup tmp;
+// flush the screen, unless that would exceed the frame rate cap, in which case
+// the changes will be picked up on a later pass through the main loop
+static void flush_screen_capped(struct timespec *now) {
+	struct timespec next_frame;
+
+	if (screen_dirty) {
+		next_frame = next_frame_time();
+		if (timespec_lt(now, &next_frame))
+			return;
+	}
 
-	tmp = *a;
-	*a = *b;
-	*b = tmp;
+	flush_screen();
 }
 
-static int queue_wakeup(struct wakeup *wake) {
-	void *tmp;
-	size_t i;
-	size_t next_size;
+static void render_gadget(struct gadget *g) {
+	trace_begin("display", g);
+	set_gadget_context(g);
+	g->module->display(g->instance, g->window);
+	clear_gadget_context();
+	trace_end("display", g);
 
-	next_size = max(wakeups_size, n_wakeups + 1);
-	if (!(tmp = realloc(wakeups, next_size * sizeof(*wakeups))))
-		return -1;
-	wakeups = tmp;
-	wakeups_size = next_size;
+	g->rendered = 1;
+	note_gadget_drawn(g);
+}
 
-	wakeups[n_wakeups] = *wake;
+// draw any gadgets on the page that haven't been drawn since their windows
+// were created. returns -1 if one of them resized itself, in which case the
+// pages have been laid out again and pg no longer exists.
+static int render_page(struct page *pg) {
+	struct gadget *g;
 
-	for (i = n_wakeups;
-	     i > 0 && wakeup_sooner(wakeups + i, wakeups + parent_index(i));
-	     i = parent_index(i))
-		wakeup_swap(wakeups + i, wakeups + parent_index(i));
+	LIST_FOR_EACH(&pg->gadgets, g, struct gadget, list) {
+		if (g->rendered)
+			continue;
 
-	++n_wakeups;
+		render_gadget(g);
+		if (need_redraw)
+			return -1;
+	}
 
 	return 0;
 }
 
-static inline struct wakeup *peek_next_wakeup(void) {
-	return (n_wakeups == 0) ? NULL : wakeups;
-}
+// keep the pages either side of the current one drawn into their (hidden)
+// windows, so that switching to one of them is just a matter of swapping
+// panels. returns -1 if the screen needs redrawing.
+static int render_adjacent_pages(void) {
+	if (!cur_page)
+		return 0;
+
+	if (!list_is_first(&pages, cur_page, struct page, list) &&
+	    render_page(list_prev(cur_page, struct page, list)))
+		return -1;
 
-static inline size_t nth_child(size_t i, size_t child) {
-	return 2 * i + child;
+	if (!list_is_last(&pages, cur_page, struct page, list) &&
+	    render_page(list_next(cur_page, struct page, list)))
+		return -1;
+
+	return 0;
 }
 
-// find the index of child wakeup node in the queue with the soonest wakeup time
-// including the parent node. returns the index of the soonest-to-be-woken
-// child, or i if no child is to be woken sooner than wakups[i].
-static inline size_t find_soonest_child_index(size_t i) {
-	size_t ret = i;
-	struct timespec soonest_time = wakeups[i].time;
-	size_t j;
+static void draw_current_page(void) {
+	struct gadget *g = NULL;
 
-	for (j = 1; j <= 2; ++j) {
-		if (nth_child(i, j) >= n_wakeups)
-			break;
+	if (!cur_page)
+		return;
 
-		if (timespec_lt(&wakeups[nth_child(i, j)].time,
-				&soonest_time)) {
-			ret = nth_child(i, j);
-			soonest_time = wakeups[nth_child(i, j)].time;
-		}
+	LIST_FOR_EACH(&cur_page->gadgets, g, struct gadget, list) {
+		render_gadget(g);
+		// the page is gone; redraw_screen() will start over
+		if (need_redraw)
+			return;
 	}
-
-	return ret;
 }
 
-static int pop_next_wakeup(struct wakeup *res) {
-	size_t i, next_i;
+void redraw_screen(void) {
+	trace_begin("redraw_screen", NULL);
+	++stats.redraws;
+	screen_dirty = 1;
 
-	if (n_wakeups == 0)
-		return -1;
+	do {
+		need_redraw = 0;
+
+		// clear() makes curses repaint every cell; erase() lets it
+		// send just the differences
+		if (low_bandwidth)
+			erase();
+		else
+			clear();
+		draw_banner(screen_width);
+		draw_current_page();
+		if (!need_redraw)
+			render_adjacent_pages();
+	} while (need_redraw);
+	// because draw_current_page() calls module->display() which can call
+	// cmod_resize() which means that we have to redraw the screen after
+	// it's done
 
-	*res = wakeups[0];
+	trace_end("redraw_screen", NULL);
+}
 
-	wakeups[0] = wakeups[--n_wakeups];
-	for (i = 0; i < n_wakeups; i = next_i) {
-		next_i = find_soonest_child_index(i);
+// bring pg to the front. its windows are normally already drawn, so this
+// only has to swap panels; the panel library takes care of repainting
+// whatever the old page leaves uncovered.
+static void switch_page(struct page *pg) {
+	struct page *old_page = cur_page;
 
-		// if we can no longer make forward progress...
-		if (next_i <= i)
-			break;
+	if (render_page(pg)) {
+		redraw_screen();
+		return;
+	}
 
-		wakeup_swap(wakeups + i, wakeups + next_i);
+	if (hide_page(old_page))
+		return;
+	cur_page = pg;
+	if (show_page(cur_page)) {
+		show_page(old_page);
+		cur_page = old_page;
 	}
+}
 
-	return 0;
+static void update_layout_and_draw(void) {
+	place_gadgets();
+
+	redraw_screen();
 }
 
 // check if using the expression a*b will overflow
@@ -585,190 +899,1424 @@ static int timespec_to_milis(struct timespec *ts, int *res) {
 	return -1;
 }
 
-static void callback_gadget(struct gadget *g) {
-	struct timespec now, delay;
-	struct wakeup w;
+static inline long long timespec_to_nanos(struct timespec *ts) {
+	return (long long)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
 
-	set_gadget_context(g);
-	delay = g->module->callback(g->instance, g->window);
-	clear_gadget_context();
+static inline struct timespec nanos_to_timespec(long long nanos) {
+	struct timespec ret;
 
-	if (clock_gettime(CLOCK_MONOTONIC, &now))
-		panic("error getting current time");
+	ret.tv_sec = nanos / 1000000000;
+	ret.tv_nsec = nanos % 1000000000;
+	if (ret.tv_nsec < 0) {
+		--ret.tv_sec;
+		ret.tv_nsec += 1000000000;
+	}
 
-	w.gadget = g;
-	w.time = timespec_add(&now, &delay);
+	return ret;
+}
 
-	if (queue_wakeup(&w))
-		panic("error queuing wakeup");
+// the period of a gadget's fixed schedule, in nanoseconds, or 0 if it just
+// wants to be called back after whatever delay its callback returns
+static long long gadget_period(struct gadget *g) {
+	long long period = timespec_to_nanos(&g->module->period);
 
-	if (need_redraw) // cmod_resize() was called
-		redraw_screen();
+	if (period > 0)
+		return period;
+
+	switch (g->module->align) {
+	case CONSTATUS_ALIGN_SECOND:
+		return 1000000000LL;
+	case CONSTATUS_ALIGN_MINUTE:
+		return 60 * 1000000000LL;
+	case CONSTATUS_ALIGN_NONE:
+	default:
+		return 0;
+	}
 }
 
-// inform all gadgets of the current size of the screen, if they are interested
-static void trigger_resize_event(void) {
-	int i;
+// the first point on the gadget's wall-clock grid strictly after now
+static struct timespec next_aligned_deadline(struct gadget *g,
+					     struct timespec *now) {
+	long long period = gadget_period(g);
+	long long phase = timespec_to_nanos(&g->module->phase) % period;
+	long long wall_now = timespec_to_nanos(now) + realtime_offset;
+	long long next;
 
-	for (i = 0; i < n_gadgets; ++i)
-		if (gadgets[i].module->resize) {
-			set_gadget_context(gadgets + i);
-			gadgets[i].module->resize(gadgets[i].instance,
-						  screen_height, screen_width);
+	next = (wall_now - phase) / period * period + phase;
+	if (next <= wall_now)
+		next += period;
+
+	return nanos_to_timespec(next - realtime_offset);
+}
+
+// work out when a gadget should next be called back, now that its callback
+// has run and asked for a delay
+static struct timespec next_deadline(struct gadget *g, struct timespec *now,
+				     struct timespec *delay) {
+	long long period, anchor, late;
+
+	if (g->module->align != CONSTATUS_ALIGN_NONE)
+		return next_aligned_deadline(g, now);
+
+	if (!(period = gadget_period(g)))
+		return timespec_add(now, delay);
+
+	// the grid starts wherever the gadget's first callback happened
+	if (g->deadline.tv_sec == 0 && g->deadline.tv_nsec == 0)
+		anchor = timespec_to_nanos(now) +
+			 timespec_to_nanos(&g->module->phase);
+	else
+		anchor = timespec_to_nanos(&g->deadline);
+
+	// step over any periods we've missed entirely, rather than running the
+	// callback back to back to catch up
+	late = timespec_to_nanos(now) - anchor;
+	if (late < 0)
+		late = -period;
+
+	return nanos_to_timespec(anchor + (late / period + 1) * period);
+}
+
+// the monotonic clock stands still while the machine is suspended, so
+// nothing is overdue afterwards, but everything on screen is out of date.
+// work out how many periods each gadget slept through, and have those that
+// want to catch up do so now.
+static void note_suspend(long long slept, struct timespec *now) {
+	long long period;
+	size_t i;
+
+	++stats.suspends;
+
+	for (i = 0; i < n_gadgets; ++i) {
+		// isolated gadgets' wakeups double as watchdogs, so they're
+		// left as they are
+		if (!(period = gadget_period(gadgets[i])) ||
+		    gadgets[i]->isolated || gadgets[i]->idle_skipped)
+			continue;
+
+		gadgets[i]->suspend_missed = slept / period;
+		if (gadgets[i]->suspend_missed > 0 &&
+		    gadgets[i]->catchup != CONSTATUS_CATCHUP_SKIP)
+			schedule_gadget(gadgets[i], now);
+	}
+}
+
+// apply the gadget's catch-up policy to a wakeup, due at the given time, that
+// is about to be acted on. returns 1 if the callback should be skipped, in
+// which case the gadget has been rescheduled.
+static int catch_up(struct gadget *g, struct timespec *due,
+		    struct timespec *now) {
+	struct timespec zero = { 0, 0 }, time;
+	long long period = gadget_period(g), missed;
+
+	if (!period || g->isolated)
+		return 0;
+
+	missed = g->suspend_missed +
+		 (timespec_to_nanos(now) - timespec_to_nanos(due)) / period;
+	g->suspend_missed = 0;
+	if (missed <= 0)
+		return 0;
+
+	switch (g->catchup) {
+	case CONSTATUS_CATCHUP_SKIP:
+		++stats.catchup_skipped;
+		time = next_deadline(g, now, &zero);
+		g->deadline = time;
+		schedule_gadget(g, &time);
+		return 1;
+	case CONSTATUS_CATCHUP_BURST:
+		g->catchup_pending = min(missed, g->catchup_limit);
+	break;
+	case CONSTATUS_CATCHUP_ONCE:
+	default:
+	break;
+	}
+
+	return 0;
+}
+
+// notice if the wall clock has been stepped relative to the monotonic one
+// (by NTP, or someone running date(1)), and if so move every wall-clock
+// aligned wakeup to its proper place. also notices suspends, by way of the
+// boot time clock.
+static void check_clock_jump(void) {
+	// slewing moves the clocks apart by at most half a millisecond per
+	// second, so this won't trigger constantly
+	static const long long tolerance = 1000000;
+	struct timespec mono, wall, boot;
+	long long offset, drift;
+	size_t i;
+
+	if (constatus_gettime(CLOCK_MONOTONIC, &mono) ||
+	    constatus_gettime(CLOCK_REALTIME, &wall))
+		panic("error getting current time");
+
+#ifdef CLOCK_BOOTTIME
+	if (constatus_gettime(CLOCK_BOOTTIME, &boot) == 0) {
+		offset = timespec_to_nanos(&boot) - timespec_to_nanos(&mono);
+		if (boottime_offset >= 0 && offset - boottime_offset > tolerance)
+			note_suspend(offset - boottime_offset, &mono);
+		boottime_offset = offset;
+	}
+#endif
+
+	offset = timespec_to_nanos(&wall) - timespec_to_nanos(&mono);
+	drift = offset - realtime_offset;
+	if (drift > -tolerance && drift < tolerance)
+		return;
+
+	realtime_offset = offset;
+
+	for (i = 0; i < wakeups.n; ++i)
+		if (wakeups.wakeups[i].gadget->module->align !=
+		    CONSTATUS_ALIGN_NONE)
+			wakeups.wakeups[i].time =
+				next_aligned_deadline(wakeups.wakeups[i].gadget,
+						      &mono);
+	reheap_wakeups(&wakeups);
+}
+
+// have the main loop call handler whenever fd has one of the given events
+// pending. only one watch per fd.
+int watch_fd(int fd, short events, fd_watch_func handler, void *data) {
+	void *tmp;
+
+	if (!(tmp = realloc(watches, (n_watches + 1) * sizeof(*watches))))
+		return -1;
+	watches = tmp;
+
+	// +1 for stdin, which is always first
+	if (!(tmp = realloc(pollfds, (n_watches + 2) * sizeof(*pollfds))))
+		return -1;
+	pollfds = tmp;
+
+	watches[n_watches].fd = fd;
+	watches[n_watches].events = events;
+	watches[n_watches].handler = handler;
+	watches[n_watches].data = data;
+	++n_watches;
+
+	return 0;
+}
+
+// safe to call from inside a handler
+void unwatch_fd(int fd) {
+	size_t i;
+
+	for (i = 0; i < n_watches; ++i)
+		if (watches[i].fd == fd)
+			watches[i].handler = NULL;
+}
+
+// drop any watches removed since last time, and fill in pollfds to match
+static void prepare_pollfds(void) {
+	size_t i, j;
+
+	if (!pollfds && !(pollfds = malloc(sizeof(*pollfds))))
+		panic("error allocating poll set");
+
+	// reading the terminal from the background would get us stopped
+	pollfds[0].fd = (idle || simulating) ? -1 : STDIN_FILENO;
+	pollfds[0].events = POLLIN;
+	pollfds[0].revents = 0;
+
+	for (i = j = 0; i < n_watches; ++i) {
+		if (!watches[i].handler)
+			continue;
+
+		watches[j] = watches[i];
+		pollfds[j + 1].fd = watches[j].fd;
+		pollfds[j + 1].events = watches[j].events;
+		pollfds[j + 1].revents = 0;
+		++j;
+	}
+	n_watches = j;
+}
+
+static void dispatch_watches(void) {
+	size_t i, n = n_watches;
+
+	// handlers may add watches, which don't have a pollfd entry yet, or
+	// remove them, which is why the handler is checked each time
+	for (i = 0; i < n; ++i)
+		if (pollfds[i + 1].revents && watches[i].handler)
+			watches[i].handler(watches[i].fd,
+					   pollfds[i + 1].revents,
+					   watches[i].data);
+}
+
+// queue the gadget's next wakeup, superseding any it already has
+void schedule_gadget(struct gadget *g, struct timespec *time) {
+	struct wakeup w;
+
+	w.gadget = g;
+	w.time = *time;
+	w.seq = ++g->wakeup_seq;
+
+	if (queue_wakeup(&wakeups, &w))
+		panic("error queuing wakeup");
+}
+
+void cancel_gadget_wakeup(struct gadget *g) {
+	++g->wakeup_seq;
+}
+
+// finish off a callback: see if the gadget drew anything new, and schedule its
+// next one
+void gadget_callback_done(struct gadget *g, struct timespec *delay) {
+	struct timespec now, time;
+
+	note_gadget_drawn(g);
+
+	if (constatus_gettime(CLOCK_MONOTONIC, &now))
+		panic("error getting current time");
+
+	// catch-up calls go back to back, and leave the grid where it was
+	if (g->catchup_pending > 0) {
+		--g->catchup_pending;
+		++stats.catchup_calls;
+		schedule_gadget(g, &now);
+	} else {
+		time = next_deadline(g, &now, delay);
+		g->deadline = time;
+		schedule_gadget(g, &time);
+	}
+
+	if (need_redraw) // cmod_resize() was called
+		redraw_screen();
+}
+
+static void callback_gadget(struct gadget *g) {
+	struct timespec delay;
+
+	++stats.callbacks;
+	++g->callbacks;
+	trace_begin("callback", g);
+
+	// isolated gadgets finish asynchronously, once their host process
+	// has done its thing; only sending the request shows up in traces
+	if (g->isolated) {
+		isolate_callback(g);
+		trace_end("callback", g);
+		return;
+	}
+
+	set_gadget_context(g);
+	delay = g->module->callback(g->instance, g->window);
+	clear_gadget_context();
+
+	gadget_callback_done(g, &delay);
+	trace_end("callback", g);
+}
+
+static void request_stats(int sig) {
+	stats_requested = 1;
+}
+
+static void request_trace(int sig) {
+	trace_requested = 1;
+}
+
+// inform all gadgets of the current size of the screen, if they are interested.
+// any resizing they do in response is only recorded; the caller lays them
+// all out afterwards, once.
+static void trigger_resize_event(void) {
+	int i;
+
+	layout_deferred = 1;
+	for (i = 0; i < n_gadgets; ++i)
+		if (gadgets[i]->module->resize) {
+			set_gadget_context(gadgets[i]);
+			gadgets[i]->module->resize(gadgets[i]->instance,
+						  screen_height, screen_width);
 			clear_gadget_context();
 		}
+	layout_deferred = 0;
+}
+
+static void resize_screen(void) {
+	getmaxyx(stdscr, screen_height, screen_width);
+	trigger_resize_event();
+	update_layout_and_draw();
+}
+
+static void handle_winch(int fd, short revents, void *data) {
+	struct signalfd_siginfo info;
+	struct timespec now;
+
+	while (read(fd, &info, sizeof(info)) == sizeof(info))
+		;
+
+	if (resize_pending)
+		return;
+
+	if (constatus_gettime(CLOCK_MONOTONIC, &now))
+		panic("error getting current time");
+	resize_due = timespec_add(&now, &resize_debounce);
+	resize_pending = 1;
+}
+
+// act on the resizes gathered up by handle_winch()
+static void apply_resize(void) {
+	struct winsize ws;
+	int c;
+
+	resize_pending = 0;
+
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 &&
+	    ws.ws_row > 0 && ws.ws_col > 0 &&
+	    is_term_resized(ws.ws_row, ws.ws_col)) {
+		resizeterm(ws.ws_row, ws.ws_col);
+
+		// curses may queue a KEY_RESIZE to tell us what we already
+		// know; don't let it get in front of real input
+		if ((c = getch()) != KEY_RESIZE && c != ERR)
+			ungetch(c);
+	}
+
+	trace_begin("resize", NULL);
+	resize_screen();
+	trace_end("resize", NULL);
+
+	screen_dirty = 1;
+	flush_screen();
+}
+
+// whether our process group owns the terminal. if there's no telling (no
+// controlling terminal), assume that it does.
+static int in_foreground(void) {
+	pid_t pgrp = tcgetpgrp(STDIN_FILENO);
+
+	return pgrp < 0 || pgrp == getpgrp();
+}
+
+static void leave_idle(void) {
+	struct timespec now;
+	size_t i;
+
+	idle = 0;
+
+	if (constatus_gettime(CLOCK_MONOTONIC, &now))
+		panic("error getting current time");
+
+	for (i = 0; i < n_gadgets; ++i) {
+		if (!gadgets[i]->idle_skipped)
+			continue;
+
+		gadgets[i]->idle_skipped = 0;
+		gadgets[i]->deadline = now;
+		schedule_gadget(gadgets[i], &now);
+	}
+
+	// whatever was in the foreground has drawn all over the screen, and
+	// the size may have changed too; start again from scratch
+	clearok(curscr, TRUE);
+	resize_pending = 1;
+	resize_due = now;
+}
+
+// go idle, or come back, if the terminal has changed hands
+static void check_idle(void) {
+	int fg = simulating || in_foreground();
+
+	if (idle && fg) {
+		leave_idle();
+	} else if (!idle && !fg) {
+		idle = 1;
+		++stats.idle_periods;
+	}
+}
+
+// only there so that SIGCONT interrupts poll(), after which check_idle() has
+// a look at who has the terminal now
+static void note_sigcont(int sig) {
+}
+
+// whether the terminal has been hung up on us. after that, it fails
+// everything with EIO.
+static int terminal_hung_up(void) {
+	return tcgetpgrp(STDIN_FILENO) < 0 && errno == EIO;
+}
+
+static void note_hangup(int sig) {
+	hangup = 1;
+}
+
+// take SIGWINCH away from curses. must be called before initscr().
+static void start_winch_fd(void) {
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGWINCH);
+	if (sigprocmask(SIG_BLOCK, &mask, NULL))
+		goto err;
+
+	if ((winch_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+		goto err_unblock;
+
+	if (watch_fd(winch_fd, POLLIN, handle_winch, NULL))
+		goto err_close;
+
+	return;
+
+  err_close:
+	close(winch_fd);
+	winch_fd = -1;
+  err_unblock:
+	sigprocmask(SIG_UNBLOCK, &mask, NULL);
+  err:
+	constatus_err("cannot watch for resizes (%s); handling each one as it "
+		      "comes", strerror(errno));
+}
+
+// act on a single key. returns -1 for a request to quit, 1 if the screen has
+// changed, and 0 otherwise.
+static int handle_key(chtype c) {
+	if (c == 'q')
+		return -1;
+
+	switch (c) {
+	case KEY_RESIZE:
+		// otherwise it's just curses echoing one we've handled
+		if (winch_fd >= 0)
+			return 0;
+
+		resize_screen();
+	break;
+	case KEY_LEFT:
+		if (!cur_page ||
+		    list_is_first(&pages, cur_page, struct page, list))
+			break;
+
+		switch_page(list_prev(cur_page, struct page, list));
+	break;
+	case KEY_RIGHT:
+		if (!cur_page ||
+		    list_is_last(&pages, cur_page, struct page, list))
+			break;
+
+		switch_page(list_next(cur_page, struct page, list));
+	break;
+	default:
+		return 0;
+	}
+
+	return 1;
+}
+
+// record how long it took from noticing input to getting its effects on
+// screen
+static void note_input_latency(struct timespec *noticed) {
+	struct timespec now, elapsed;
+	unsigned long usecs;
+
+	if (constatus_gettime(CLOCK_MONOTONIC, &now))
+		panic("error getting current time");
+
+	elapsed = timespec_subtract(&now, noticed);
+	usecs = elapsed.tv_sec * 1000000 + elapsed.tv_nsec / 1000;
+
+	stats.input_latency = usecs;
+	stats.input_latency_total += usecs;
+	stats.input_latency_max = max(stats.input_latency_max, usecs);
+	++stats.input_frames;
+}
+
+// deal with everything that has been typed, noticed at the given time, and
+// show the results in a single frame. returns 1 if we've been asked to quit.
+static int handle_keypresses(struct timespec *noticed) {
+	chtype c;
+	int ret, changed = 0;
+
+	while ((c = getch()) != ERR) {
+		++stats.keypresses;
+		if ((ret = handle_key(c)) < 0)
+			return 1;
+		changed |= ret;
+	}
+
+	// no keys, or none that did anything; possibly a false alarm
+	// generated by the receipt of a signal
+	if (!changed)
+		return 0;
+
+	screen_dirty = 1;
+	flush_screen();
+	note_input_latency(noticed);
+
+	// now that the new page is on screen, get its neighbours ready
+	if (render_adjacent_pages())
+		redraw_screen();
+
+	return 0;
+}
+
+// whether there's input waiting, for callbacks to give way to
+static int input_pending(void) {
+	struct pollfd pfd = {
+		.fd = STDIN_FILENO,
+		.events = POLLIN,
+	};
+
+	return !simulating && poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+}
+
+static int path_search(const char **dirs, int n_dirs, const char *fname,
+		       char *buf, size_t buf_size) {
+	int i;
+	struct stat stats;
+
+	for (i = 0; i < n_dirs; ++i) {
+		if (!dirs[i])
+			continue;
+
+		snprintf(buf, buf_size, "%s/%s", dirs[i], fname);
+
+		if (stat(buf, &stats) == 0)
+			break;
+	}
+
+	if (i >= n_dirs)
+		return -1;
+
+	return 0;
+}
+
+// pick up the layout hints from a gadget's entry in the 'load' list
+static void process_layout_hints(struct gadget *g, config_setting_t *settings) {
+	config_setting_t *setting;
+	const char *group;
+
+	if ((setting = config_setting_get_member(settings, "group"))) {
+		if (!(group = config_setting_get_string(setting)))
+			conf_error("%s:%d: group must be a string",
+				   conf_file, config_setting_source_line(setting));
+		if (!(g->layout_group = strdup(group)))
+			panic("error allocating memory");
+	}
+
+	if ((setting = config_setting_get_member(settings, "page")) &&
+	    (config_setting_type(setting) != CONFIG_TYPE_INT ||
+	     (g->layout_pin = config_setting_get_int(setting)) < 1))
+		conf_error("%s:%d: page must be a positive integer",
+			   conf_file, config_setting_source_line(setting));
+}
+
+static void process_catchup_settings(struct gadget *g,
+				     config_setting_t *settings) {
+	static const char *policies[] = {
+		[CONSTATUS_CATCHUP_ONCE] = "once",
+		[CONSTATUS_CATCHUP_SKIP] = "skip",
+		[CONSTATUS_CATCHUP_BURST] = "burst",
+	};
+	config_setting_t *setting;
+	const char *policy;
+	size_t i;
+
+	if ((setting = config_setting_get_member(settings, "catchup"))) {
+		policy = config_setting_get_string(setting);
+		for (i = 0; policy && i < array_size(policies); ++i)
+			if (strcmp(policy, policies[i]) == 0)
+				break;
+		if (!policy || i == array_size(policies))
+			conf_error("%s:%d: catchup must be one of "
+				   "\"once\", \"skip\" or \"burst\"",
+				   conf_file, config_setting_source_line(setting));
+		g->catchup = i;
+	}
+
+	if ((setting = config_setting_get_member(settings, "catchup_limit")) &&
+	    (config_setting_type(setting) != CONFIG_TYPE_INT ||
+	     (g->catchup_limit = config_setting_get_int(setting)) < 1))
+		conf_error("%s:%d: catchup_limit must be a positive integer",
+			   conf_file, config_setting_source_line(setting));
+}
+
+// read a setting given in seconds, either as an integer or as a float
+static int setting_seconds(config_setting_t *setting, struct timespec *res) {
+	double secs;
+
+	switch (config_setting_type(setting)) {
+	case CONFIG_TYPE_INT:
+		secs = config_setting_get_int(setting);
+	break;
+	case CONFIG_TYPE_FLOAT:
+		secs = config_setting_get_float(setting);
+	break;
+	default:
+		return -1;
+	}
+
+	if (secs <= 0)
+		return -1;
+
+	res->tv_sec = secs;
+	res->tv_nsec = (secs - res->tv_sec) * 1000000000;
+
+	return 0;
+}
+
+static void load_exec_gadget(config_setting_t *settings) {
+	config_setting_t *setting;
+	struct exec_options opts = {
+		.command = NULL,
+		.interval = { .tv_sec = 5, .tv_nsec = 0, },
+		.timeout = { .tv_sec = 10, .tv_nsec = 0, },
+		.height = 1,
+		.width = 20,
+		.coprocess = 0,
+	};
+	const char *name = "exec";
+
+	// commands run in real time, and would be timed out by virtual time
+	// racing ahead of them
+	if (simulating)
+		conf_error("%s: exec gadgets cannot be simulated", conf_file);
+
+	if (!settings ||
+	    config_setting_lookup_string(settings, "command",
+					 &opts.command) == CONFIG_FALSE)
+		conf_error("%s: exec gadgets need a 'command' setting",
+			   conf_file);
+
+	config_setting_lookup_string(settings, "name", &name);
+	config_setting_lookup_bool(settings, "coprocess", &opts.coprocess);
+
+	if ((setting = config_setting_get_member(settings, "interval")) &&
+	    setting_seconds(setting, &opts.interval))
+		conf_error("%s:%d: interval must be a positive number of "
+			   "seconds", conf_file,
+			   config_setting_source_line(setting));
+
+	if ((setting = config_setting_get_member(settings, "timeout")) &&
+	    setting_seconds(setting, &opts.timeout))
+		conf_error("%s:%d: timeout must be a positive number of "
+			   "seconds", conf_file,
+			   config_setting_source_line(setting));
+
+	if ((setting = config_setting_get_member(settings, "height")) &&
+	    (config_setting_type(setting) != CONFIG_TYPE_INT ||
+	     (opts.height = config_setting_get_int(setting)) < 1))
+		conf_error("%s:%d: height must be a positive integer",
+			   conf_file, config_setting_source_line(setting));
+
+	if ((setting = config_setting_get_member(settings, "width")) &&
+	    (config_setting_type(setting) != CONFIG_TYPE_INT ||
+	     (opts.width = config_setting_get_int(setting)) < 1))
+		conf_error("%s:%d: width must be a positive integer",
+			   conf_file, config_setting_source_line(setting));
+
+	if (exec_load(name, &opts))
+		panic("error adding exec gadget");
+}
+
+// the last component of a path
+static const char *file_name(const char *path) {
+	const char *slash = strrchr(path, '/');
+
+	return slash ? slash + 1 : path;
+}
+
+// the directories modules are looked for in, most preferred first. unused
+// entries are NULL.
+static void get_module_dirs(const char *dirs[N_MODULE_DIRS]) {
+	static char user_mod_dir_buf[_POSIX_PATH_MAX+1];
+
+	if (module_dir) {
+		dirs[0] = module_dir;
+		dirs[1] = NULL;
+		return;
+	}
+
+	dirs[0] = NULL;
+	if (home_dir) {
+		snprintf(user_mod_dir_buf, sizeof(user_mod_dir_buf),
+			 "%s/modules", home_dir);
+		dirs[0] = user_mod_dir_buf;
+	}
+	dirs[1] = SYSTEM_MODULE_DIR;
+}
+
+// dlopen() a private copy of a module, so that it can be rebuilt while it's
+// loaded: rewriting a file that's mapped in place would change the code out
+// from under us, and opening it again by name would just get us the object
+// that's already loaded. the copy has to stay open for as long as the object
+// is loaded, so that the name the dynamic linker knows it by (its
+// /proc/self/fd path) isn't reused; its fd is stored in *fd.
+static void *open_module_copy(const char *libpath, int *fd) {
+	char path[64];
+	struct stat st;
+	void *obj = NULL;
+	off_t off = 0;
+	int in;
+
+	*fd = -1;
+	if ((in = open(libpath, O_RDONLY | O_CLOEXEC)) < 0)
+		return NULL;
+
+	if (fstat(in, &st) ||
+	    (*fd = memfd_create("constatus-module", MFD_CLOEXEC)) < 0)
+		goto out;
+
+	while (off < st.st_size)
+		if (sendfile(*fd, in, &off, st.st_size - off) <= 0)
+			goto out_close;
+
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", *fd);
+	if ((obj = dlopen(path, RTLD_NOW | RTLD_LOCAL)))
+		goto out;
+
+  out_close:
+	close(*fd);
+	*fd = -1;
+  out:
+	close(in);
+
+	return obj;
+}
+
+// the module table in a loaded module, or NULL (with the reason in *why) if
+// it isn't usable. a module built against an older constatus.h has a shorter
+// table, without the fields added since; it's zero-extended into a copy,
+// which is returned in *copy (otherwise NULL) for the caller to free once it's
+// done with the module. the zeroes all mean that the module doesn't use what
+// was added.
+struct constatus_module *find_module_table(void *obj,
+					struct constatus_module **copy,
+					const char **why) {
+	struct constatus_module *module;
+	const size_t *size_sym;
+	size_t size;
+
+	*copy = NULL;
+
+	if (!(module = dlsym(obj, "module_table"))) {
+		*why = "no `module_table' symbol";
+		return NULL;
+	}
+
+	// modules from before the size was recorded have the original table,
+	// which stopped short of the scheduling hints
+	if ((size_sym = dlsym(obj, "module_table_size")))
+		size = *size_sym;
+	else
+		size = offsetof(struct constatus_module, period);
+
+	if (size > sizeof(*module)) {
+		*why = "built against a newer constatus.h";
+		return NULL;
+	}
+	if (size < offsetof(struct constatus_module, period)) {
+		*why = "module table is too small";
+		return NULL;
+	}
+
+	if (size < sizeof(*module)) {
+		if (!(*copy = calloc(1, sizeof(**copy)))) {
+			*why = "out of memory";
+			return NULL;
+		}
+		memcpy(*copy, module, size);
+		module = *copy;
+	}
+
+	if (!module->init || !module->display || !module->callback) {
+		free(*copy);
+		*copy = NULL;
+		*why = "module is missing required functions";
+		return NULL;
+	}
+
+	return module;
+}
+
+// dlerror() if the dynamic linker had something to say, or else errno
+static const char *dl_error(void) {
+	const char *e = dlerror();
+
+	return e ? e : strerror(errno);
+}
+
+static void load_module(const char *name, config_setting_t *settings) {
+	void *obj;
+	struct constatus_module *module, *builtin, *copy;
+	const char *module_dirs[N_MODULE_DIRS], *why;
+	char libname[_POSIX_PATH_MAX+1];
+	char libpath[_POSIX_PATH_MAX+1];
+	size_t i;
+	int isolated = 0, fd;
+
+	if (settings)
+		config_setting_lookup_bool(settings, "isolated", &isolated);
+
+	// a host process wouldn't share our virtual time
+	if (isolated && simulating) {
+		constatus_info("%s: not isolated while simulating", name);
+		isolated = 0;
+	}
+
+	// modules built into the binary take precedence, and needn't be found
+	builtin = find_builtin_module(name);
+
+	get_module_dirs(module_dirs);
+
+	snprintf(libname, sizeof(libname), "%s.so", name);
+	if (!builtin &&
+	    path_search(module_dirs, array_size(module_dirs), libname, libpath,
+			sizeof(libpath))) {
+		if (conf_reloading)
+			load_error("error loading module: cannot find %s",
+				   libname);
+		cleanup();
+		warnx("error loading module: cannot find %s in:", libname);
+		for (i = 0; i < array_size(module_dirs); ++i)
+			if (module_dirs[i])
+				warnx("   %s", module_dirs[i]);
+		exit(EXIT_FAILURE);
+	}
+
+	// isolated modules are only ever loaded by their host process
+	if (isolated) {
+		if (isolate_load(name, builtin ? NULL : libpath))
+			load_error("error starting isolated module %s", name);
+		if (!builtin &&
+		    !(gadgets[n_gadgets - 1]->module_path = strdup(libpath)))
+			panic("error allocating memory");
+	} else if (builtin) {
+		if (add_gadget(builtin, name, NULL, -1, NULL))
+			load_error("error adding module %s", name);
+	} else {
+		if (!(obj = open_module_copy(libpath, &fd)))
+			load_error("error loading module %s: %s", libpath,
+				   dl_error());
+
+		if (!(module = find_module_table(obj, &copy, &why))) {
+			dlclose(obj);
+			close(fd);
+			load_error("error loading module %s: %s", libpath, why);
+		}
+
+		if (add_gadget(module, name, obj, fd, copy))
+			load_error("error adding module %s", name);
+		if (!(gadgets[n_gadgets - 1]->module_path = strdup(libpath)))
+			panic("error allocating memory");
+	}
+}
+
+// load the named module, taking any per-gadget options from settings, which is
+// the gadget's group in the 'load' list, or NULL if it was just given by name
+void load_gadget(const char *name, config_setting_t *settings) {
+	// built in gadgets take precedence over modules
+	if (strcmp(name, "exec") == 0)
+		load_exec_gadget(settings);
+	else if (strcmp(name, "self") == 0) {
+		if (self_load(name))
+			panic("error adding self gadget");
+	} else
+		load_module(name, settings);
+
+	if (settings) {
+		process_layout_hints(gadgets[n_gadgets - 1], settings);
+		process_catchup_settings(gadgets[n_gadgets - 1], settings);
+		config_setting_lookup_bool(settings, "keep_sampling",
+					   &gadgets[n_gadgets - 1]->keep_sampling);
+	}
+}
+
+// load the current version of a gadget's module, and swap a freshly
+// initialized gadget in for the old one, in the same place on the screen.
+// nothing else is touched unless the new version wants a different size, in
+// which case everything is laid out again. if anything goes wrong, the old
+// version carries on.
+static void reload_gadget(size_t i) {
+	struct gadget *old = gadgets[i], *g;
+	struct constatus_module *module, *copy;
+	struct timespec now;
+	const char *dirs[N_MODULE_DIRS], *libname, *why;
+	char libpath[_POSIX_PATH_MAX+1];
+	char *path;
+	void *obj;
+	int fd, resized;
+
+	libname = file_name(old->module_path);
+
+	// a copy in a more preferred directory may have turned up
+	get_module_dirs(dirs);
+	if (path_search(dirs, N_MODULE_DIRS, libname, libpath,
+			sizeof(libpath))) {
+		gadget_err(old, "cannot reload: %s is gone", libname);
+		return;
+	}
+	if (!(path = strdup(libpath))) {
+		gadget_err(old, "cannot reload: out of memory");
+		return;
+	}
+
+	// the host loads the module, so it just needs replacing
+	if (old->isolated) {
+		isolate_reload(old, libpath);
+		free(old->module_path);
+		old->module_path = path;
+		gadget_info(old, "reloaded from %s", libpath);
+		return;
+	}
+
+	if (!(obj = open_module_copy(libpath, &fd))) {
+		gadget_err(old, "cannot reload %s: %s", libpath, dl_error());
+		free(path);
+		return;
+	}
+
+	if (!(module = find_module_table(obj, &copy, &why))) {
+		gadget_err(old, "cannot reload %s: %s", libpath, why);
+		goto err_close;
+	}
+
+	if (!(g = alloc_gadget(module, old->name))) {
+		gadget_err(old, "cannot reload: out of memory");
+		free(copy);
+		goto err_close;
+	}
+	g->dl_handle = obj;
+	g->dl_fd = fd;
+	g->module_path = path;
+	g->module_copy = copy;
+
+	// what came from the config file carries over
+	g->layout_group = old->layout_group;
+	old->layout_group = NULL;
+	g->layout_pin = old->layout_pin;
+	g->keep_sampling = old->keep_sampling;
+	g->catchup = old->catchup;
+	g->catchup_limit = old->catchup_limit;
+	g->conf_key = old->conf_key;
+	old->conf_key = NULL;
+
+	// any resizing is dealt with below, once it's been swapped in
+	layout_deferred = 1;
+	set_gadget_context(g);
+	if ((g->instance = module->init()) && module->resize)
+		module->resize(g->instance, screen_height, screen_width);
+	clear_gadget_context();
+	layout_deferred = 0;
+
+	if (!g->instance) {
+		gadget_err(old, "cannot reload %s: init() failed", libpath);
+		old->layout_group = g->layout_group;
+		g->layout_group = NULL;
+		old->conf_key = g->conf_key;
+		g->conf_key = NULL;
+		free_gadget(g);
+		return;
+	}
+
+	// take over the old gadget's spot on its page
+	resized = g->height != old->height || g->width != old->width;
+	g->x = old->x;
+	g->y = old->y;
+	g->layout_page = old->layout_page;
+	g->window = old->window;
+	g->panel = old->panel;
+	old->window = NULL;
+	old->panel = NULL;
+	if (!list_is_empty(&old->list)) {
+		list_append(&old->list, &g->list);
+		list_del(&old->list);
+	}
+
+	gadgets[i] = g;
+	free_gadget(old);
+
+	if (resized) {
+		update_layout_and_draw();
+	} else if (g->window) {
+		werase(g->window);
+		render_gadget(g);
+	}
+
+	if (constatus_gettime(CLOCK_MONOTONIC, &now))
+		panic("error getting current time");
+	schedule_gadget(g, &now);
+
+	gadget_info(g, "reloaded from %s", libpath);
+
+	return;
+
+  err_close:
+	dlclose(obj);
+	close(fd);
+	free(path);
+}
+
+static void reload_modules(void) {
+	size_t i;
+
+	for (i = 0; i < n_gadgets; ++i) {
+		if (!gadgets[i]->reload_pending)
+			continue;
+
+		gadgets[i]->reload_pending = 0;
+		trace_begin("reload", gadgets[i]);
+		reload_gadget(i);
+		trace_end("reload", gadgets[i]);
+	}
+}
+
+static void handle_file_change(int fd, short revents, void *data) {
+	union {
+		struct inotify_event ev;
+		char buf[4096];
+	} u;
+	struct inotify_event *ev;
+	struct timespec now;
+	ssize_t n;
+	char *p;
+	size_t i;
+	int changed = 0;
+
+	while ((n = read(fd, u.buf, sizeof(u.buf))) > 0) {
+		for (p = u.buf; p < u.buf + n; p += sizeof(*ev) + ev->len) {
+			ev = (struct inotify_event *)p;
+			if (!ev->len)
+				continue;
+
+			if (ev->wd == conf_wd &&
+			    strcmp(ev->name, file_name(conf_file)) == 0) {
+				conf_changed = 1;
+				changed = 1;
+			}
+
+			for (i = 0; i < n_gadgets; ++i) {
+				if (gadgets[i]->module_path &&
+				    strcmp(file_name(gadgets[i]->module_path),
+					   ev->name) == 0) {
+					gadgets[i]->reload_pending = 1;
+					changed = 1;
+				}
+			}
+		}
+	}
+
+	if (!changed)
+		return;
+
+	// every write puts it off a bit longer
+	if (constatus_gettime(CLOCK_MONOTONIC, &now))
+		panic("error getting current time");
+	reload_due = timespec_add(&now, &reload_delay);
+	reload_pending = 1;
+}
+
+// watch the directories modules come from, so that gadgets can be reloaded
+// when their module changes, and the config file, so that the gadgets can be
+// brought in line with it
+static void start_file_watch(void) {
+	const char *dirs[N_MODULE_DIRS];
+	char conf_dir[_POSIX_PATH_MAX+1];
+	size_t i;
+	int n = 0;
+
+	if ((file_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+		goto err;
+
+	get_module_dirs(dirs);
+	for (i = 0; i < N_MODULE_DIRS; ++i)
+		if (dirs[i] && inotify_add_watch(file_watch_fd, dirs[i],
+						 IN_CLOSE_WRITE | IN_MOVED_TO) >= 0)
+			++n;
+
+	// editors often write a new file and rename it over the old one, so
+	// it's the directory that's watched
+	if (conf_file) {
+		snprintf(conf_dir, sizeof(conf_dir), "%.*s",
+			 (int)(file_name(conf_file) - conf_file), conf_file);
+		if ((conf_wd = inotify_add_watch(file_watch_fd,
+						 *conf_dir ? conf_dir : ".",
+						 IN_CLOSE_WRITE | IN_MOVED_TO)) >= 0)
+			++n;
+	}
+
+	if (!n || watch_fd(file_watch_fd, POLLIN, handle_file_change, NULL))
+		goto err_close;
+
+	return;
+
+  err_close:
+	close(file_watch_fd);
+	file_watch_fd = -1;
+	conf_wd = -1;
+  err:
+	constatus_err("cannot watch for changes to modules or the config file "
+		      "(%s); send SIGHUP to reload the config", strerror(errno));
 }
 
-static int handle_keypress(void) {
-	chtype c;
-	struct page *old_page;
+// the module an entry in the 'load' list is for. each entry is either a
+// module name, or a group giving the module name along with options for the
+// gadget.
+static const char *entry_module(const char *conf_file,
+				config_setting_t *entry) {
+	const char *module_name;
 
-	c = getch();
+	if (config_setting_type(entry) == CONFIG_TYPE_STRING)
+		return config_setting_get_string(entry);
 
-	// timeout, no key was pressed; probably a false alarm generated by the
-	// receipt of a signal
-	if (c == ERR)
-		return 0;
+	if (config_setting_type(entry) != CONFIG_TYPE_GROUP ||
+	    config_setting_lookup_string(entry, "module",
+					 &module_name) == CONFIG_FALSE)
+		conf_error("%s:%d: 'load' entries must be module names, or "
+			   "groups with a 'module' setting",
+			   conf_file, config_setting_source_line(entry));
 
-	// a request to quit...
-	if (c == 'q')
-		return 1;
+	return module_name;
+}
 
-	switch (c) {
-	case KEY_RESIZE:
-		getmaxyx(stdscr, screen_height, screen_width);
-		trigger_resize_event();
-		update_layout_and_draw();
-	break;
-	case KEY_LEFT:
-		if (!cur_page ||
-		    list_is_first(&pages, cur_page, struct page, list))
-			break;
+static void write_setting(FILE *fh, config_setting_t *setting) {
+	const char *name = config_setting_name(setting), *str;
+	int i, n;
 
-		old_page = cur_page;
-		if (hide_page(old_page))
-			break;
-		cur_page = list_prev(cur_page, struct page, list);
-		if (show_page(cur_page)) {
-			show_page(old_page);
-			cur_page = old_page;
-			break;
-		}
+	if (name)
+		fprintf(fh, "%s=", name);
 
-		redraw_screen();
+	switch (config_setting_type(setting)) {
+	case CONFIG_TYPE_INT:
+		fprintf(fh, "%d", config_setting_get_int(setting));
 	break;
-	case KEY_RIGHT:
-		if (!cur_page ||
-		    list_is_last(&pages, cur_page, struct page, list))
-			break;
+	case CONFIG_TYPE_INT64:
+		fprintf(fh, "%lldL", config_setting_get_int64(setting));
+	break;
+	case CONFIG_TYPE_FLOAT:
+		fprintf(fh, "%a", config_setting_get_float(setting));
+	break;
+	case CONFIG_TYPE_BOOL:
+		fputs(config_setting_get_bool(setting) ? "true" : "false", fh);
+	break;
+	case CONFIG_TYPE_STRING:
+		// with its length, so that there's no mistaking where it ends
+		str = config_setting_get_string(setting);
+		fprintf(fh, "%zu\"%s", strlen(str), str);
+	break;
+	case CONFIG_TYPE_GROUP:
+	case CONFIG_TYPE_ARRAY:
+	case CONFIG_TYPE_LIST:
+		fprintf(fh, "%d(", config_setting_type(setting));
+		n = config_setting_length(setting);
+		for (i = 0; i < n; ++i)
+			write_setting(fh, config_setting_get_elem(setting, i));
+		fputc(')', fh);
+	break;
+	}
 
-		old_page = cur_page;
-		if (hide_page(old_page))
-			break;
-		cur_page = list_next(cur_page, struct page, list);
-		if (show_page(cur_page)) {
-			show_page(old_page);
-			cur_page = old_page;
-			break;
-		}
+	fputc(';', fh);
+}
 
-		redraw_screen();
-	break;
-	default:
-		return 0;
+// everything an entry in the 'load' list says, written out as a string, so
+// that a reload can tell whether it's changed. NULL if there's no memory.
+static char *entry_key(config_setting_t *entry) {
+	char *key = NULL;
+	size_t len;
+	FILE *fh;
+
+	if (!(fh = open_memstream(&key, &len)))
+		return NULL;
+
+	write_setting(fh, entry);
+
+	if (fclose(fh)) {
+		free(key);
+		return NULL;
 	}
 
-	update_panels();
-	doupdate();
+	return key;
+}
 
-	return 0;
+static void load_entry(const char *conf_file, config_setting_t *entry) {
+	const char *module_name = entry_module(conf_file, entry);
+
+	load_gadget(module_name,
+		    config_setting_type(entry) == CONFIG_TYPE_GROUP ?
+		    entry : NULL);
+
+	if (!(gadgets[n_gadgets - 1]->conf_key = entry_key(entry)))
+		panic("error allocating memory");
 }
 
-static int path_search(const char **dirs, int n_dirs, const char *fname,
-		       char *buf, size_t buf_size) {
+void process_load_section(const char *conf_file, config_setting_t *load) {
 	int i;
-	struct stat stats;
 
-	for (i = 0; i < n_dirs; ++i) {
-		if (!dirs[i])
-			continue;
+	if (config_setting_is_list(load) == CONFIG_FALSE)
+		conf_error("%s:%d: the 'load' config setting must be a list",
+			   conf_file, config_setting_source_line(load));
 
-		snprintf(buf, buf_size, "%s/%s", dirs[i], fname);
+	for (i = 0; i < config_setting_length(load); ++i)
+		load_entry(conf_file, config_setting_get_elem(load, i));
+}
 
-		if (stat(buf, &stats) == 0)
-			break;
+// reread the config file and bring the gadgets in line with its 'load' list.
+// a gadget whose entry is just as it was carries on untouched; the rest are
+// torn down, new gadgets are loaded for the entries that are new (or
+// different), and then everything is laid out again, once. if the new config
+// can't be loaded, nothing changes. nothing but the 'load' list is looked at.
+static void reload_conf(void) {
+	struct gadget **old_gadgets = gadgets, **all = NULL, *g;
+	config_setting_t *load, *entry;
+	struct timespec now;
+	config_t cfg;
+	FILE *conf_fh;
+	size_t n_old = n_gadgets, n_new, n_added, i, j, k;
+	size_t *match = NULL;
+	char *used = NULL, *key;
+
+	if (!conf_file) {
+		constatus_info("there's no config file to reload");
+		return;
 	}
 
-	if (i >= n_dirs)
-		return -1;
+	if (!(conf_fh = fopen(conf_file, "r"))) {
+		constatus_err("error reopening config file %s: %s", conf_file,
+			      strerror(errno));
+		return;
+	}
 
-	return 0;
-}
+	config_init(&cfg);
+	if (config_read(&cfg, conf_fh) == CONFIG_FALSE) {
+		if (config_error_type(&cfg) == CONFIG_ERR_PARSE)
+			constatus_err("%s:%d: %s", conf_file,
+				      config_error_line(&cfg),
+				      config_error_text(&cfg));
+		else
+			constatus_err("%s: %s", conf_file,
+				      config_error_text(&cfg));
+		fclose(conf_fh);
+		goto out;
+	}
+	fclose(conf_fh);
 
-void load_gadget(const char *name) {
-	void *obj;
-	struct constatus_module *module;
-	const char *module_dirs[2];
-	char libname[_POSIX_PATH_MAX+1];
-	char libpath[_POSIX_PATH_MAX+1];
-	char user_mod_dir_buf[_POSIX_PATH_MAX+1];
-	char *user_mod_dir = NULL;
-	size_t i;
+	if (!(load = config_lookup(&cfg, "load")) ||
+	    config_setting_is_list(load) == CONFIG_FALSE ||
+	    !(n_new = config_setting_length(load))) {
+		constatus_err("%s: 'load' must be a list of at least one gadget; "
+			      "keeping the gadgets as they are", conf_file);
+		goto out;
+	}
 
-	if (module_dir) {
-		module_dirs[0] = module_dir;
-		module_dirs[1] = NULL;
-	} else {
-		if (home_dir) {
-			snprintf(user_mod_dir_buf, sizeof(user_mod_dir_buf),
-				 "%s/modules", home_dir);
-			user_mod_dir = user_mod_dir_buf;
-		}
-		module_dirs[0] = user_mod_dir;
-		module_dirs[1] = SYSTEM_MODULE_DIR;
+	// match[i] is the old gadget that the i'th entry is for, or n_old if
+	// there isn't one; used[j] is set once old gadget j is spoken for
+	if (!(match = malloc(n_new * sizeof(*match))) ||
+	    !(used = calloc(n_old, sizeof(*used))) ||
+	    !(all = malloc(n_new * sizeof(*all)))) {
+		constatus_err("cannot reload config file: out of memory");
+		goto out;
 	}
 
-	snprintf(libname, sizeof(libname), "%s.so", name);
-	if (path_search(module_dirs, array_size(module_dirs), libname, libpath,
-			sizeof(libpath))) {
-		cleanup();
-		warnx("error loading module: cannot find %s in:", libname);
-		for (i = 0; i < array_size(module_dirs); ++i)
-			if (module_dirs[i])
-				warnx("   %s", module_dirs[i]);
-		exit(EXIT_FAILURE);
+	// new gadgets are loaded into a gadgets[] of their own, so that they
+	// can all be thrown away if one of them fails
+	gadgets = NULL;
+	n_gadgets = 0;
+	conf_reloading = 1;
+	if (setjmp(reload_env)) {
+		for (i = 0; i < n_gadgets; ++i)
+			free_gadget(gadgets[i]);
+		free(gadgets);
+		gadgets = old_gadgets;
+		n_gadgets = n_old;
+		conf_reloading = 0;
+		layout_deferred = 0;
+
+		// a new gadget's init() may have had the layout worked out
+		// without the old ones
+		layout_forget();
+		update_layout_and_draw();
+		goto out;
 	}
 
-	if (!(obj = dlopen(libpath, RTLD_NOW | RTLD_LOCAL)))
-		panicx("error loading module: %s", dlerror());
+	for (i = 0; i < n_new; ++i) {
+		entry = config_setting_get_elem(load, i);
+		entry_module(conf_file, entry);
+		if (!(key = entry_key(entry)))
+			panic("error allocating memory");
+
+		match[i] = n_old;
+		for (j = 0; j < n_old; ++j)
+			if (!used[j] && old_gadgets[j]->conf_key &&
+			    strcmp(old_gadgets[j]->conf_key, key) == 0) {
+				used[j] = 1;
+				match[i] = j;
+				break;
+			}
+		free(key);
+	}
 
-	if (!(module = dlsym(obj, "module_table")))
-		panicx("could not find symbol `module_table' in module file: %s",
-		     dlerror());
+	// gadgets[] only has the new gadgets in it for now, so anything
+	// their init()s do to their size waits until the kept ones are back
+	layout_deferred = 1;
+	for (i = 0; i < n_new; ++i)
+		if (match[i] == n_old)
+			load_entry(conf_file, config_setting_get_elem(load, i));
+	conf_reloading = 0;
+
+	// everything goes in the order the config file gives
+	n_added = n_gadgets;
+	for (i = 0, k = 0; i < n_new; ++i)
+		all[i] = (match[i] < n_old) ? old_gadgets[match[i]] :
+					      gadgets[k++];
+	free(gadgets);
+	gadgets = all;
+	n_gadgets = n_new;
+	all = NULL;
 
-	if (add_gadget(module, name))
-		panicx("error adding module %s", name);
-}
+	for (j = 0; j < n_old; ++j)
+		if (!used[j])
+			free_gadget(old_gadgets[j]);
+	free(old_gadgets);
 
-void process_load_section(const char *conf_file, config_setting_t *load) {
-	int i;
-	config_setting_t *module_name;
+	if (constatus_gettime(CLOCK_MONOTONIC, &now))
+		panic("error getting current time");
 
-	if (config_setting_is_list(load) == CONFIG_FALSE)
-		errx(EXIT_FAILURE,
-		     "%s:%d: the 'load' config setting must be a list",
-		     conf_file, config_setting_source_line(load));
+	// the new gadgets have yet to hear how big the screen is. the layout
+	// is still deferred, and is worked out once they have.
+	for (i = 0; i < n_new; ++i) {
+		if (match[i] < n_old)
+			continue;
 
-	for (i = 0; i < config_setting_length(load); ++i) {
-		module_name = config_setting_get_elem(load, i);
-		if (config_setting_type(module_name) != CONFIG_TYPE_STRING)
-			errx(EXIT_FAILURE,
-			     "%s:%d: module names must be strings",
-			     conf_file,
-			     config_setting_source_line(module_name));
+		g = gadgets[i];
+		if (g->module->resize) {
+			set_gadget_context(g);
+			g->module->resize(g->instance, screen_height,
+					  screen_width);
+			clear_gadget_context();
+		}
+		schedule_gadget(g, &now);
+	}
+	layout_deferred = 0;
+
+	layout_forget();
+	update_layout_and_draw();
+
+	constatus_info("%s: reloaded: %zu gadgets kept, %zu added, %zu removed",
+		       conf_file, n_new - n_added, n_added,
+		       n_old - (n_new - n_added));
+
+  out:
+	free(match);
+	free(used);
+	free(all);
+	config_destroy(&cfg);
+}
+
+// act on the changes that handle_file_change() (or a SIGHUP) has noticed
+static void apply_reloads(void) {
+	reload_pending = 0;
 
-		load_gadget(config_setting_get_string(module_name));
+	if (conf_changed) {
+		conf_changed = 0;
+		trace_begin("reload_conf", NULL);
+		reload_conf();
+		trace_end("reload_conf", NULL);
 	}
+
+	reload_modules();
 }
 
 void handle_conf_file_error(const char *conf_file, config_t *cfg) {
@@ -782,6 +2330,124 @@ void handle_conf_file_error(const char *conf_file, config_t *cfg) {
 		     conf_file);
 }
 
+// called once the config file has been read, and again from main() in case
+// there wasn't one. only the first call does anything, so that the log
+// doesn't get everything from before it started twice.
+static void start_message_log(void) {
+	static int started = 0;
+
+	if (started)
+		return;
+	started = 1;
+
+	if (msglog_config.path && msglog_start())
+		panic("error opening message log %s", msglog_config.path);
+
+	// catch the log up on anything from before it started
+	replay_messages();
+}
+
+void process_log_settings(const char *conf_file, config_t *cfg) {
+	config_setting_t *setting;
+	const char *str;
+	int i;
+
+	// the command line takes precedence
+	if (!msglog_config.path &&
+	    config_lookup_string(cfg, "log_file", &str) == CONFIG_TRUE) {
+		snprintf(log_file_buf, sizeof(log_file_buf), "%s", str);
+		msglog_config.path = log_file_buf;
+	}
+
+	if (config_lookup_int(cfg, "log_max_size", &i) == CONFIG_TRUE)
+		msglog_config.max_size = i;
+
+	if (config_lookup_int(cfg, "log_keep", &i) == CONFIG_TRUE)
+		msglog_config.keep = i;
+
+	if ((setting = config_lookup(cfg, "log_format"))) {
+		str = config_setting_get_string(setting);
+		if (str && strcmp(str, "text") == 0)
+			msglog_config.format = MSGLOG_FORMAT_TEXT;
+		else if (str && strcmp(str, "binary") == 0)
+			msglog_config.format = MSGLOG_FORMAT_BINARY;
+		else
+			errx(EXIT_FAILURE,
+			     "%s:%d: log_format must be \"text\" or \"binary\"",
+			     conf_file, config_setting_source_line(setting));
+	}
+}
+
+void process_display_settings(const char *conf_file, config_t *cfg) {
+	config_setting_t *setting;
+
+	if (max_fps < 0 && (setting = config_lookup(cfg, "max_fps"))) {
+		if (config_setting_type(setting) != CONFIG_TYPE_INT ||
+		    (max_fps = config_setting_get_int(setting)) < 0)
+			errx(EXIT_FAILURE,
+			     "%s:%d: max_fps must be a non-negative integer",
+			     conf_file, config_setting_source_line(setting));
+	}
+
+	if ((setting = config_lookup(cfg, "callback_budget")) &&
+	    setting_seconds(setting, &callback_budget))
+		errx(EXIT_FAILURE,
+		     "%s:%d: callback_budget must be a positive number of "
+		     "seconds", conf_file, config_setting_source_line(setting));
+
+	if ((setting = config_lookup(cfg, "resize_debounce")) &&
+	    setting_seconds(setting, &resize_debounce))
+		errx(EXIT_FAILURE,
+		     "%s:%d: resize_debounce must be a positive number of "
+		     "seconds", conf_file, config_setting_source_line(setting));
+}
+
+void process_bandwidth_settings(const char *conf_file, config_t *cfg) {
+	config_setting_t *setting;
+	int i;
+
+	if (low_bandwidth < 0 &&
+	    config_lookup_bool(cfg, "low_bandwidth", &i) == CONFIG_TRUE)
+		low_bandwidth = i;
+
+	if ((setting = config_lookup(cfg, "output_budget"))) {
+		if (config_setting_type(setting) != CONFIG_TYPE_INT ||
+		    (output_budget = config_setting_get_int(setting)) < 0)
+			errx(EXIT_FAILURE,
+			     "%s:%d: output_budget must be a non-negative integer",
+			     conf_file, config_setting_source_line(setting));
+	}
+}
+
+void process_message_settings(const char *conf_file, config_t *cfg) {
+	config_setting_t *setting;
+
+	if ((setting = config_lookup(cfg, "message_rate")) &&
+	    (config_setting_type(setting) != CONFIG_TYPE_INT ||
+	     (message_limits.rate = config_setting_get_int(setting)) < 0))
+		errx(EXIT_FAILURE,
+		     "%s:%d: message_rate must be a non-negative integer",
+		     conf_file, config_setting_source_line(setting));
+
+	if ((setting = config_lookup(cfg, "message_burst")) &&
+	    (config_setting_type(setting) != CONFIG_TYPE_INT ||
+	     (message_limits.burst = config_setting_get_int(setting)) < 1))
+		errx(EXIT_FAILURE,
+		     "%s:%d: message_burst must be a positive integer",
+		     conf_file, config_setting_source_line(setting));
+}
+
+void process_exec_settings(const char *conf_file, config_t *cfg) {
+	config_setting_t *setting;
+
+	if ((setting = config_lookup(cfg, "exec_max_children")) &&
+	    (config_setting_type(setting) != CONFIG_TYPE_INT ||
+	     (exec_max_children = config_setting_get_int(setting)) < 1))
+		errx(EXIT_FAILURE,
+		     "%s:%d: exec_max_children must be a positive integer",
+		     conf_file, config_setting_source_line(setting));
+}
+
 void process_conf_file(const char *conf_file) {
 	config_t cfg;
 	config_setting_t *load_list;
@@ -796,25 +2462,159 @@ void process_conf_file(const char *conf_file) {
 
 	fclose(conf_fh);
 
+	process_log_settings(conf_file, &cfg);
+	process_display_settings(conf_file, &cfg);
+	process_bandwidth_settings(conf_file, &cfg);
+	process_message_settings(conf_file, &cfg);
+	process_exec_settings(conf_file, &cfg);
+	// get the log going before loading anything, so that it catches
+	// errors from module init()
+	start_message_log();
+
 	if ((load_list = config_lookup(&cfg, "load")))
 		process_load_section(conf_file, load_list);
 
 	config_destroy(&cfg);
 }
 
+// a frame rate cap for --max-fps: a non-negative number of frames per second,
+// of which there can't be more than there are nanoseconds. -1 if it doesn't
+// parse.
+static int parse_fps(const char *str) {
+	long n;
+	char *end;
+
+	errno = 0;
+	n = strtol(str, &end, 10);
+	if (errno || end == str || *end || n < 0 || n > 1000000000)
+		return -1;
+
+	return n;
+}
+
+// a duration for --simulate, in seconds: a number, with an optional s, m, h
+// or d after it for seconds, minutes, hours or days. -1 if it doesn't parse.
+static long long parse_duration(const char *str) {
+	long long n, unit;
+	char *end;
+
+	errno = 0;
+	n = strtoll(str, &end, 10);
+	if (errno || end == str || n <= 0)
+		return -1;
+
+	switch (*end) {
+	case '\0':
+	case 's':
+		unit = 1;
+	break;
+	case 'm':
+		unit = 60;
+	break;
+	case 'h':
+		unit = 60 * 60;
+	break;
+	case 'd':
+		unit = 24 * 60 * 60;
+	break;
+	default:
+		return -1;
+	}
+	if (*end && end[1])
+		return -1;
+
+	// it has to fit in a timespec's worth of nanoseconds
+	if (n > LLONG_MAX / 1000000000 / unit)
+		return -1;
+
+	return n * unit;
+}
+
+// when simulating, draw to a terminal that isn't there. its size comes from
+// LINES and COLUMNS if they're set, and from terminfo otherwise.
+static int start_null_terminal(void) {
+	const char *term = getenv("TERM");
+	FILE *out, *in;
+
+	if (!(out = fopen("/dev/null", "w")))
+		return -1;
+	if (!(in = fopen("/dev/null", "r"))) {
+		fclose(out);
+		return -1;
+	}
+
+	if (!newterm(term ? term : "vt100", out, in)) {
+		fclose(out);
+		fclose(in);
+		return -1;
+	}
+
+	// the rest only matters to a real terminal, and this one may well not
+	// support it all
+	start_color();
+	keypad(stdscr, TRUE);
+	curs_set(0);
+	nodelay(stdscr, TRUE);
+
+	return 0;
+}
+
+// one line on how a simulation is going, printed every so often so that any
+// growth over time shows up
+static void print_sim_sample(struct timespec *now) {
+	struct timespec elapsed = timespec_subtract(now, &sim_start);
+
+	printf("sim %lds: wakeups %lu, callbacks %lu, flushes %lu, "
+	       "wakeup heap %zu/%zu, messages %zu (%lu bytes), "
+	       "gadget memory %lu, rss %lld\n",
+	       (long)elapsed.tv_sec, stats.wakeups, stats.callbacks,
+	       stats.flushes, wakeups.n, wakeups.size, count_messages(),
+	       stats.message_bytes, stats.gadget_bytes, resident_size());
+	fflush(stdout);
+}
+
+// how many callbacks each gadget got, and for periodic ones, how many periods
+// went by in that time
+static void print_sim_summary(struct timespec *now) {
+	long long elapsed, period;
+	size_t i;
+
+	elapsed = timespec_to_nanos(now) - timespec_to_nanos(&sim_start);
+	print_sim_sample(now);
+
+	for (i = 0; i < n_gadgets; ++i) {
+		if ((period = gadget_period(gadgets[i])))
+			printf("sim %s: %lu callbacks over %lld periods, "
+			       "%zu bytes allocated\n",
+			       gadgets[i]->name, gadgets[i]->callbacks,
+			       elapsed / period, gadgets[i]->pool.bytes);
+		else
+			printf("sim %s: %lu callbacks, %zu bytes allocated\n",
+			       gadgets[i]->name, gadgets[i]->callbacks,
+			       gadgets[i]->pool.bytes);
+	}
+}
+
 int main(int argc, char **argv) {
 	size_t i;
 	struct wakeup wakeup, *wakeup_p;
-	struct timespec now, delay;
-	struct pollfd stdin_poll;
-	int overflow, milis, s;
+	struct timespec now, delay, deadline, next_frame, budget_end;
+	int milis, s, quit, have_deadline;
+	size_t n_due;
 	char *home;
 	char home_dir_buf[_POSIX_PATH_MAX+1];
 	char conf_file_buf[_POSIX_PATH_MAX+1];
 	char module_dir_buf[_POSIX_PATH_MAX+1];
+	struct sigaction sa;
 	struct option longopts[] = {
 		{"module-dir",	required_argument,	NULL,	0},
 		{"config-file",	required_argument,	NULL,	1},
+		{"log-file",	required_argument,	NULL,	2},
+		{"max-fps",	required_argument,	NULL,	3},
+		{"low-bandwidth", no_argument,		NULL,	4},
+		{"stats",	no_argument,		NULL,	5},
+		{"trace",	required_argument,	NULL,	6},
+		{"simulate",	required_argument,	NULL,	7},
 		{NULL,		0,			NULL,	0},
 	};
 	int opt;
@@ -824,7 +2624,7 @@ int main(int argc, char **argv) {
 
 	opterr = 0;
 	optopt = 0;
-	while ((opt = getopt_long(argc, argv, "+:m:c:", longopts,
+	while ((opt = getopt_long(argc, argv, "+:m:c:l:f:bst:S:", longopts,
 				  NULL)) != -1) {
 		switch (opt) {
 		case 'm':
@@ -839,6 +2639,39 @@ int main(int argc, char **argv) {
 				 optarg);
 			conf_file = conf_file_buf;
 		break;
+		case 'l':
+		case 2:
+			snprintf(log_file_buf, sizeof(log_file_buf), "%s",
+				 optarg);
+			msglog_config.path = log_file_buf;
+		break;
+		case 'f':
+		case 3:
+			if ((max_fps = parse_fps(optarg)) < 0)
+				errx(EXIT_FAILURE, "bad frame rate cap '%s'; it "
+				     "must be a whole number of frames per "
+				     "second, or 0 for no cap", optarg);
+		break;
+		case 'b':
+		case 4:
+			low_bandwidth = 1;
+		break;
+		case 's':
+		case 5:
+			dump_stats = 1;
+		break;
+		case 't':
+		case 6:
+			snprintf(trace_file_buf, sizeof(trace_file_buf), "%s",
+				 optarg);
+			trace_file = trace_file_buf;
+		break;
+		case 'S':
+		case 7:
+			if ((sim_duration = parse_duration(optarg)) < 0)
+				errx(EXIT_FAILURE, "bad simulation length '%s'",
+				     optarg);
+		break;
 		case '?':
 			if (optopt)
 				errx(EXIT_FAILURE, "unknown argument '-%c'",
@@ -858,6 +2691,17 @@ int main(int argc, char **argv) {
 		}
 	}
 
+	if (trace_file && trace_start(trace_file))
+		err(EXIT_FAILURE, "error allocating trace buffer");
+
+	// before anything is loaded, so that it all runs in virtual time. the
+	// stats are the point of a simulation, so they're always printed.
+	if (sim_duration) {
+		if (simulate_start())
+			err(EXIT_FAILURE, "error getting current time");
+		dump_stats = 1;
+	}
+
 	if ((home = getenv("HOME"))) {
 		snprintf(home_dir_buf, sizeof(home_dir_buf), "%s/.constatus",
 			 home);
@@ -876,11 +2720,40 @@ int main(int argc, char **argv) {
 
 	if (conf_file)
 		process_conf_file(conf_file);
+	start_message_log();
+
+	if (max_fps < 0)
+		max_fps = DEFAULT_MAX_FPS;
+	frame_interval.tv_sec = 0;
+	frame_interval.tv_nsec = (max_fps > 0) ? 1000000000 / max_fps : 0;
+	// max_fps == 1 would otherwise produce tv_nsec == 1000000000
+	if (frame_interval.tv_nsec >= 1000000000) {
+		frame_interval.tv_sec = frame_interval.tv_nsec / 1000000000;
+		frame_interval.tv_nsec %= 1000000000;
+	}
 
 	if (n_gadgets <= 0)
 		panicx("no gadgets loaded; aborting");
 
-	if (!initscr() || start_color() == ERR ||
+	if (low_bandwidth < 0)
+		low_bandwidth = 0;
+
+	thread_io_fd = open("/proc/thread-self/io", O_RDONLY | O_CLOEXEC);
+	if (low_bandwidth && thread_io_fd < 0)
+		constatus_err("cannot measure terminal output (%s); low bandwidth "
+			      "mode will not throttle", strerror(errno));
+
+	// a simulation has no terminal, and so no resizes, and it shouldn't
+	// be thrown off by a module being rebuilt
+	if (!simulating) {
+		start_winch_fd();
+		start_file_watch();
+	}
+
+	if (simulating) {
+		if (start_null_terminal())
+			panicx("error starting the null terminal");
+	} else if (!initscr() || start_color() == ERR ||
 	    cbreak() == ERR || noecho() == ERR ||
 	    keypad(stdscr, TRUE) == ERR || nonl() == ERR ||
 	    intrflush(stdscr, FALSE) == ERR || curs_set(0) == ERR ||
@@ -890,48 +2763,234 @@ int main(int argc, char **argv) {
 	setup_color_palate();
 	getmaxyx(stdscr, screen_height, screen_width);
 
+	// a bit under the line rate, to leave room for keypress-driven frames
+	if (low_bandwidth && output_budget == 0 && baudrate() > 0)
+		output_budget = baudrate() / 10 * 3 / 4;
+	if (constatus_gettime(CLOCK_MONOTONIC, &rate_window_start))
+		panic("error getting current time");
+
 	trigger_resize_event();
 
+	// poll() is interrupted by the signal, so the dump happens promptly
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = request_stats;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGUSR1, &sa, NULL))
+		panic("error setting up SIGUSR1 handler");
+	if (trace_file) {
+		sa.sa_handler = request_trace;
+		if (sigaction(SIGUSR2, &sa, NULL))
+			panic("error setting up SIGUSR2 handler");
+	}
+	sa.sa_handler = note_sigcont;
+	if (sigaction(SIGCONT, &sa, NULL))
+		panic("error setting up SIGCONT handler");
+	// a hangup either means that the terminal has gone, or asks for the
+	// config file to be reread; the main loop works out which
+	sa.sa_handler = note_hangup;
+	if (sigaction(SIGHUP, &sa, NULL))
+		panic("error setting up SIGHUP handler");
+
+	check_clock_jump();
+	if (simulating) {
+		if (constatus_gettime(CLOCK_MONOTONIC, &sim_start))
+			panic("error getting current time");
+		delay = nanos_to_timespec(sim_duration * 1000000000LL);
+		sim_end = timespec_add(&sim_start, &delay);
+		sim_sample_interval = nanos_to_timespec(sim_duration *
+							1000000000LL /
+							SIM_SAMPLES);
+		sim_next_sample = timespec_add(&sim_start, &sim_sample_interval);
+	}
+
 	update_layout_and_draw();
 	for (i = 0; i < n_gadgets; ++i)
-		callback_gadget(gadgets + i);
-	update_panels();
-	doupdate();
+		callback_gadget(gadgets[i]);
+	flush_screen();
 
-	stdin_poll.fd = STDIN_FILENO;
-	stdin_poll.events = POLLIN;
-	while (1) {
-		wakeup_p = peek_next_wakeup();
+	for (;;) {
+		check_clock_jump();
+		check_idle();
+		wakeup_p = peek_next_wakeup(&wakeups);
 
-		if (clock_gettime(CLOCK_MONOTONIC, &now))
+		if (constatus_gettime(CLOCK_MONOTONIC, &now))
 			panic("error getting current time");
 
-		delay = timespec_subtract(&wakeup_p->time, &now);
-		overflow = timespec_to_milis(&delay, &milis);
-		// in case we've overshot...
-		if (milis < 0)
-			milis = 0;
+		// sleep until the next gadget is due, or until the next frame
+		// can go out if there's something waiting to be drawn. when
+		// idle, there may be nothing to wake up for at all.
+		have_deadline = 0;
+		if (wakeup_p) {
+			deadline = wakeup_p->time;
+			have_deadline = 1;
+		}
+		if (screen_dirty && !idle) {
+			next_frame = next_frame_time();
+			if (!have_deadline || timespec_lt(&next_frame, &deadline))
+				deadline = next_frame;
+			have_deadline = 1;
+		}
+		if (resize_pending && !idle &&
+		    (!have_deadline || timespec_lt(&resize_due, &deadline))) {
+			deadline = resize_due;
+			have_deadline = 1;
+		}
+		if (reload_pending && !idle &&
+		    (!have_deadline || timespec_lt(&reload_due, &deadline))) {
+			deadline = reload_due;
+			have_deadline = 1;
+		}
+
+		// a simulation doesn't sleep, but skips straight to the
+		// deadline. it's over once there's nothing left to do before
+		// the end.
+		if (simulating) {
+			if (!have_deadline || !timespec_lt(&deadline, &sim_end)) {
+				simulate_advance(&sim_end);
+				break;
+			}
+			simulate_advance(&deadline);
+			if (constatus_gettime(CLOCK_MONOTONIC, &now))
+				panic("error getting current time");
+
+			if (!timespec_lt(&now, &sim_next_sample)) {
+				print_sim_sample(&now);
+				while (!timespec_lt(&now, &sim_next_sample))
+					sim_next_sample =
+						timespec_add(&sim_next_sample,
+							     &sim_sample_interval);
+			}
+		}
+
+		if (have_deadline) {
+			delay = timespec_subtract(&deadline, &now);
+			// round up, so that we don't wake up just short of the
+			// deadline and spin until it arrives
+			delay.tv_nsec += 999999;
+			timespec_to_milis(&delay, &milis);
+			// in case we've overshot...
+			if (milis < 0)
+				milis = 0;
+		} else {
+			milis = -1;
+		}
 
-		s = poll(&stdin_poll, 1, milis);
+		prepare_pollfds();
+		s = poll(pollfds, n_watches + 1, milis);
 		if (s < 0 && errno != EINTR)
 			panic("error polling the input sources");
+		++stats.wakeups;
 
-		if (((s > 0 && stdin_poll.revents & POLLIN) || s < 0) &&
-		    handle_keypress())
+		// the terminal went away without a SIGHUP reaching us
+		if (s > 0 && pollfds[0].revents & (POLLHUP | POLLERR))
 			break;
 
-		if (s == 0 && !overflow) {
-			pop_next_wakeup(&wakeup);
+		// a SIGHUP that came with the terminal going away leaves nothing
+		// to come back for; any other asks for the config to be reread
+		if (hangup) {
+			hangup = 0;
+			if (terminal_hung_up())
+				break;
+
+			conf_changed = 1;
+			reload_pending = 1;
+			reload_due = now;
+		}
+
+		if (constatus_gettime(CLOCK_MONOTONIC, &now))
+			panic("error getting current time");
+
+		if (stats_requested) {
+			stats_requested = 0;
+			log_stats();
+		}
+		if (trace_requested) {
+			trace_requested = 0;
+			trace_write();
+		}
+
+		// input comes first, so that it's never stuck behind callbacks
+		if (!idle && ((s > 0 && pollfds[0].revents & POLLIN) || s < 0)) {
+			trace_begin("keypress", NULL);
+			quit = handle_keypresses(&now);
+			trace_end("keypress", NULL);
+			if (quit)
+				break;
+		}
+
+		if (s > 0)
+			dispatch_watches();
+
+		if (constatus_gettime(CLOCK_MONOTONIC, &now))
+			panic("error getting current time");
+
+		if (resize_pending && !idle && !timespec_lt(&now, &resize_due))
+			apply_resize();
+		if (reload_pending && !idle && !timespec_lt(&now, &reload_due))
+			apply_reloads();
+
+		// run everything that's due, letting each gadget go at most
+		// once, and then draw the results all at once. if that takes
+		// longer than callback_budget, or a key is pressed, the rest
+		// wait for the next pass round the loop.
+		budget_end = timespec_add(&now, &callback_budget);
+		for (n_due = wakeups.n; n_due > 0; --n_due) {
+			wakeup_p = peek_next_wakeup(&wakeups);
+			if (timespec_lt(&now, &wakeup_p->time))
+				break;
+
+			pop_next_wakeup(&wakeups, &wakeup);
+			if (wakeup.seq != wakeup.gadget->wakeup_seq)
+				continue;
+			if (idle && !wakeup.gadget->keep_sampling) {
+				wakeup.gadget->idle_skipped = 1;
+				continue;
+			}
+			if (catch_up(wakeup.gadget, &wakeup.time, &now))
+				continue;
 			callback_gadget(wakeup.gadget);
-			update_panels();
-			doupdate();
+
+			if (constatus_gettime(CLOCK_MONOTONIC, &now))
+				panic("error getting current time");
+			if (!timespec_lt(&now, &budget_end) ||
+			    (!idle && input_pending())) {
+				++stats.callback_yields;
+				break;
+			}
 		}
+
+		if (!idle)
+			flush_screen_capped(&now);
+	}
+
+	if (simulating) {
+		if (constatus_gettime(CLOCK_MONOTONIC, &now))
+			panic("error getting current time");
+		print_sim_summary(&now);
 	}
 
+	// before the gadgets (whose names the trace refers to) go away
+	trace_write();
+	trace_stop();
+
+	// cleanup(), in pieces: the stats (with what each gadget has
+	// allocated) need the gadgets, but the messages wait until they've
+	// been torn down, so that anything said on the way out is shown and
+	// logged
+	if ((s = leave_curses()) == EXIT_SUCCESS && dump_stats)
+		print_stats(stdout);
+
 	clear_pages();
+	layout_forget();
+	for (i = 0; i < n_gadgets; ++i)
+		free_gadget(gadgets[i]);
 	free(gadgets);
-	if (messages)
-		free(messages);
+	free_wakeups(&wakeups);
+
+	msglog_stop();
+	if (s == EXIT_SUCCESS)
+		print_messages(stdout);
+	free_messages();
 
-	return cleanup();
+	return s;
 }
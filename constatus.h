@@ -2,11 +2,14 @@
 #ifndef _CONSTATUS_H_
 #define _CONSTATUS_H_
 
+#include <stdio.h>
 #include <curses.h>
 #include <panel.h>
 #include <time.h>
 #include <stdarg.h>
 #include <limits.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 // all the stuff that's specific to the core program...
 #ifdef CONSTATUS_INTERNAL
@@ -65,15 +68,107 @@ inline static int list_is_empty(struct list *l) {
 	     (cur) = (save),						\
 	     (save) = container_of((cur)->member.next, type, member))
 
+struct wakeup {
+	struct timespec time;
+	struct gadget *gadget;
+	// a wakeup is stale, and is ignored, if this doesn't match the
+	// gadget's wakeup_seq
+	unsigned long seq;
+};
+
+// the wakeup heap (wakeup.c)
+struct wakeup_heap {
+	struct wakeup *wakeups;
+	size_t n, size;
+};
+
+extern int queue_wakeup(struct wakeup_heap *h, struct wakeup *wake);
+extern int pop_next_wakeup(struct wakeup_heap *h, struct wakeup *res);
+extern void reheap_wakeups(struct wakeup_heap *h);
+extern void remove_wakeups(struct wakeup_heap *h, struct gadget *g);
+extern void free_wakeups(struct wakeup_heap *h);
+
+inline static struct wakeup *peek_next_wakeup(struct wakeup_heap *h) {
+	return (h->n == 0) ? NULL : h->wakeups;
+}
+
+// per-gadget message rate limiting; see take_token() in messages.c
+struct message_bucket {
+	struct timespec ready;
+	unsigned long suppressed;
+};
+
+// memory allocated through cmod_alloc() and friends (alloc.c): how much is in
+// use now, and the most there has ever been
+struct alloc_pool {
+	struct list blocks;
+	size_t bytes, peak;
+	unsigned long n_blocks;
+};
+
+extern void pool_init(struct alloc_pool *pool);
+extern void pool_release(struct alloc_pool *pool);
+
 struct gadget {
 	struct list list;
 	char name[_POSIX_PATH_MAX+1];
 	int height, width;
 	int x, y;
+	// the page the layout put the gadget on, and the hints it went by: a
+	// group of gadgets to share a page with, and a page to go on (counting
+	// from 1; 0 for any)
+	int layout_page;
+	char *layout_group;
+	int layout_pin;
 	struct constatus_module *module;
 	void *instance;
 	WINDOW *window;
 	PANEL *panel;
+	// set once display() has drawn into the current window. callbacks keep
+	// it up to date from then on, even while the gadget's page is hidden.
+	int rendered;
+	// bumped every time the contents of the window are seen to change;
+	// content_hash is what they hashed to at the time
+	unsigned long generation;
+	uint32_t content_hash;
+	// the (monotonic) time the gadget's current wakeup was scheduled for
+	struct timespec deadline;
+	// see struct wakeup
+	unsigned long wakeup_seq;
+	// non-NULL if the module is running in a separate host process
+	struct isolated_gadget *isolated;
+	// from the module, or the gadget's settings; see struct
+	// constatus_module. idle_skipped is set if a wakeup was dropped while
+	// the core was idle, and it needs running again when it wakes up.
+	int keep_sampling;
+	int idle_skipped;
+	// the catch-up policy (an enum constatus_catchup), from the module or
+	// the gadget's settings; the catch-up calls still to be made; and
+	// periods missed while the machine was suspended
+	int catchup;
+	int catchup_limit;
+	int catchup_pending;
+	long long suspend_missed;
+	// callbacks run, for the summary at the end of a simulation
+	unsigned long callbacks;
+	// what the module has allocated with cmod_alloc(), which is freed when
+	// the gadget is; and the module's shared object, if it was loaded from
+	// one
+	struct alloc_pool pool;
+	void *dl_handle;
+	// where the module was found (NULL for built in gadgets); the private
+	// copy of it that was loaded (-1 if it's not loaded in this process);
+	// and whether it's changed and is due to be reloaded
+	char *module_path;
+	int dl_fd;
+	int reload_pending;
+	// the gadget's entry in the 'load' list, written out so that a reload
+	// of the config file can tell whether it's changed
+	char *conf_key;
+	// the zero-extended copy of the module's table that module points to,
+	// if the module was built against an older constatus.h
+	struct constatus_module *module_copy;
+	struct message_bucket message_bucket;
 };
 
 struct page {
@@ -86,15 +181,83 @@ enum message_type {
 	MSGTYPE_INFO,
 };
 
+// a distinct message, as identified by the gadget that logged it and a key
+// (usually the format string). repeats bump count and time rather than being
+// stored again.
 struct message {
-	unsigned len;
+	struct message *hash_next;
+	// NULL for the core's messages, and for those of a gadget that has
+	// gone, which are detached: out of the hash table, never to be repeated
+	struct gadget *gadget;
+	int detached;
+	char *key;
+	uint32_t key_hash;
+	unsigned long count;
+	// when it was first and most recently logged
+	struct timespec first;
 	struct timespec time;
 	enum message_type type;
+	// the length of the text, and the space there is for it
+	unsigned len;
+	size_t size;
 	char text[];
 };
 
+struct message_limits {
+	int rate;
+	int burst;
+};
+
+// counters describing what the core has been up to
+struct constatus_stats {
+	// trips round the main loop, gadget callbacks run, and full redraws
+	unsigned long wakeups;
+	// times the core has gone idle for want of a terminal to draw on
+	unsigned long idle_periods;
+	// times due callbacks were put off, because they'd run for too long or
+	// there was input to deal with
+	unsigned long callback_yields;
+	// suspends noticed, wakeups skipped and extra callbacks run by the
+	// catch-up policies
+	unsigned long suspends;
+	unsigned long catchup_skipped;
+	unsigned long catchup_calls;
+	// keys read, and how long it took (in microseconds) from noticing them
+	// to putting a frame on screen: the latest, the total over all
+	// input_frames, and the worst
+	unsigned long keypresses;
+	unsigned long input_frames;
+	unsigned long input_latency;
+	unsigned long input_latency_total;
+	unsigned long input_latency_max;
+	unsigned long callbacks;
+	unsigned long redraws;
+	unsigned long flushes;
+	unsigned long flushes_skipped;
+	// bytes sent to the terminal, in total and by the most recent frame,
+	// and the rate at which they're being sent (in bytes per second)
+	unsigned long bytes_written;
+	unsigned long frame_bytes;
+	unsigned long output_rate;
+	// messages that were folded into an earlier identical one, and ones
+	// dropped by rate limiting
+	unsigned long messages_repeated;
+	unsigned long messages_suppressed;
+	// memory taken up by the message store, and allocated by gadgets with
+	// cmod_alloc()
+	unsigned long message_bytes;
+	unsigned long gadget_bytes;
+	unsigned long layouts_computed;
+	unsigned long layout_cache_hits;
+	// requests not sent to exec helpers because they were still busy
+	unsigned long coprocess_ticks_skipped;
+};
+
+extern struct constatus_stats stats;
 extern int screen_height, screen_width;
 extern int need_redraw;
+// set while gadgets' resize() hooks are being run; see trigger_resize_event()
+extern int layout_deferred;
 extern struct gadget *current_gadget;
 
 // {set,clear}_gadget_context(), used around calls into module callbacks to
@@ -112,7 +275,122 @@ inline static struct gadget *get_gadget_context() {
 	return current_gadget;
 }
 
+enum msglog_format {
+	MSGLOG_FORMAT_TEXT,
+	MSGLOG_FORMAT_BINARY,
+};
+
+// settings for the persistent message log (msglog.c). path is NULL if the log
+// is disabled.
+struct msglog_config {
+	const char *path;
+	off_t max_size;
+	int keep;
+	enum msglog_format format;
+};
+
+extern struct msglog_config msglog_config;
+
+extern int msglog_start(void);
+extern void msglog_stop(void);
+extern void msglog_append(enum message_type type, struct timespec *time,
+			  const char *text, size_t len);
+
+// the message store (messages.c)
+extern struct message_limits message_limits;
+
+extern void log_gadget_message(struct gadget *g, const char *key,
+			       const char *fmt, va_list args,
+			       enum message_type type);
+extern void log_message(const char *fmt, va_list args, enum message_type type);
+extern void forget_gadget_messages(struct gadget *g);
+extern void replay_messages(void);
+extern size_t count_messages(void);
+extern void print_messages(FILE *fh);
+extern void free_messages(void);
+
+typedef void (*fd_watch_func)(int fd, short revents, void *data);
+
+extern int watch_fd(int fd, short events, fd_watch_func handler, void *data);
+extern void unwatch_fd(int fd);
+
+extern void schedule_gadget(struct gadget *g, struct timespec *time);
+extern void cancel_gadget_wakeup(struct gadget *g);
+extern void gadget_callback_done(struct gadget *g, struct timespec *delay);
+extern struct gadget *new_gadget(struct constatus_module *module,
+				 const char *name);
+extern void free_gadget(struct gadget *g);
+extern struct constatus_module *find_module_table(void *obj,
+					struct constatus_module **copy,
+					const char **why);
+extern void print_gadget_memory(FILE *fh);
+extern void redraw_screen(void);
+extern void note_gadget_drawn(struct gadget *g);
+
+// isolated gadgets (isolate.c)
+extern int isolate_host_active;
+extern int isolate_load(const char *name, const char *libpath);
+extern void isolate_callback(struct gadget *g);
+extern void isolate_host_message(const char *key, const char *fmt,
+				 va_list args, enum message_type type);
+extern void isolate_host_resized(struct gadget *g);
+extern void isolate_reload(struct gadget *g, const char *libpath);
+
+// modules linked into the binary (builtin.c)
+extern struct constatus_module *find_builtin_module(const char *name);
+
 extern void place_gadgets(void);
+
+// the exec gadget (exec.c)
+struct exec_options {
+	const char *command;
+	struct timespec interval;
+	struct timespec timeout;
+	int height, width;
+	// keep the command running, and talk to it (see exec.c)
+	int coprocess;
+};
+
+extern int exec_max_children;
+extern int exec_load(const char *name, struct exec_options *opts);
+
+// the self gadget, and stats dumps (self.c)
+extern int self_load(const char *name);
+extern long long resident_size(void);
+extern void print_stats(FILE *fh);
+extern void log_stats(void);
+
+// tracing (trace.c)
+extern int trace_active;
+extern int trace_start(const char *path);
+extern void trace_event(char phase, const char *name, struct gadget *g);
+extern void trace_forget_gadget(struct gadget *g);
+extern int trace_write(void);
+extern void trace_stop(void);
+
+// mark the beginning and end of something worth seeing in a trace. g is the
+// gadget it's being done for, or NULL.
+inline static void trace_begin(const char *name, struct gadget *g) {
+	if (trace_active)
+		trace_event('B', name, g);
+}
+
+inline static void trace_end(const char *name, struct gadget *g) {
+	if (trace_active)
+		trace_event('E', name, g);
+}
+
+// time, real or simulated (clock.c)
+extern int simulating;
+extern int simulate_start(void);
+extern void simulate_advance(struct timespec *to);
+extern int constatus_gettime(clockid_t clock, struct timespec *ts);
+
+// layout.c
+extern int layout_gadgets(struct gadget **gadgets, size_t n,
+			  int screen_height, int screen_width);
+extern void layout_forget(void);
+
 extern void constatus_msg(const char *fmt, enum message_type type, ...);
 extern void constatus_vmsg(const char *fmt, va_list args,
 			   enum message_type type);
@@ -120,11 +398,22 @@ extern void constatus_err(const char *fmt, ...);
 extern void constatus_verr(const char *fmt, va_list args);
 extern void constatus_info(const char *fmt, ...);
 extern void constatus_vinfo(const char *fmt, va_list args);
+extern void gadget_err(struct gadget *g, const char *fmt, ...);
+extern void gadget_info(struct gadget *g, const char *fmt, ...);
 
 #endif /* CONSTATUS_INTERNAL */
 
 // the interfaces exposed to client modules...
 
+static inline int timespec_lt(struct timespec *a, struct timespec *b) {
+	return (a->tv_sec < b->tv_sec) ?
+		1
+	: (a->tv_sec > b->tv_sec) ?
+		0
+	:
+		(a->tv_nsec < b->tv_nsec);
+}
+
 static inline struct timespec timespec_subtract(struct timespec *a,
 					        struct timespec *b) {
 	struct timespec ret;
@@ -153,20 +442,87 @@ static inline struct timespec timespec_add(struct timespec *a,
 	return ret;
 }
 
+// wall-clock boundaries a gadget's callbacks can be lined up with
+enum constatus_align {
+	CONSTATUS_ALIGN_NONE = 0,
+	CONSTATUS_ALIGN_SECOND,
+	CONSTATUS_ALIGN_MINUTE,
+};
+
+// what to do about callbacks a periodic gadget missed, because the machine
+// was suspended or constatus was held up: run the callback once and carry on
+// from the next point on the grid; skip straight to the next point; or make
+// up for the missed calls with a bounded burst of back to back ones
+enum constatus_catchup {
+	CONSTATUS_CATCHUP_ONCE = 0,
+	CONSTATUS_CATCHUP_SKIP,
+	CONSTATUS_CATCHUP_BURST,
+};
+
 typedef void *(*constatus_init_func)(void);
 typedef struct timespec (*constatus_cb_func)(void *, WINDOW *);
 typedef void (*constatus_disp_func)(void *, WINDOW *);
 typedef void (*constatus_resize_func)(void *, int, int);
+typedef void (*constatus_destroy_func)(void *);
 struct constatus_module {
 	int height, width;
 	constatus_init_func init;
 	constatus_cb_func callback;
 	constatus_disp_func display;
 	constatus_resize_func resize;
+	// optional scheduling. if period is non-zero, the callback is run every
+	// period on a fixed grid, and whatever delay it returns is ignored; the
+	// grid is offset by phase. if align is set, the grid is lined up with
+	// the wall clock instead of with when the gadget was loaded, and period
+	// defaults to one second or minute.
+	struct timespec period;
+	struct timespec phase;
+	enum constatus_align align;
+	// keep running the callback while the terminal isn't being looked at
+	// (constatus is in the background, say), for modules that record
+	// history or otherwise can't afford gaps. other gadgets are left alone
+	// until the terminal is back.
+	int keep_sampling;
+	// only for gadgets with a period; catchup_limit caps bursts (0 means
+	// the default)
+	enum constatus_catchup catchup;
+	int catchup_limit;
+	// optional; called when the gadget goes away (at exit, or when it's
+	// unloaded) to release anything the instance holds other than memory
+	// from cmod_alloc(), which is freed regardless
+	constatus_destroy_func destroy;
 };
-#define CONSTATUS_MODULE		struct constatus_module module_table
+// a module that's built into the binary (see builtin.c) is compiled with
+// CONSTATUS_BUILTIN set to its name, and its table is named after it, so as
+// not to clash with the others
+#define CONSTATUS_BUILTIN_TABLE(name)	CONSTATUS_BUILTIN_TABLE_(name)
+#define CONSTATUS_BUILTIN_TABLE_(name)	builtin_module_##name
+#ifdef CONSTATUS_BUILTIN
+#define CONSTATUS_MODULE		struct constatus_module \
+					CONSTATUS_BUILTIN_TABLE(CONSTATUS_BUILTIN)
+#else
+// module_table_size says how big the table is in the constatus.h the module
+// was built against, so that tables from older modules, which don't have the
+// fields added since, can be told apart. modules without it have the
+// original table, which ends at resize.
+#define CONSTATUS_MODULE		const size_t module_table_size = \
+						sizeof(struct constatus_module); \
+					struct constatus_module module_table
+#endif
 
 extern int cmod_resize(int height, int width);
+// the time by the given clock, as clock_gettime(). modules should use this
+// rather than calling clock_gettime() themselves, so that they keep to the
+// core's virtual time when it's simulating.
+extern int cmod_gettime(clockid_t clock, struct timespec *ts);
+// like malloc() and co, but the memory is charged to the calling gadget, shows
+// up in its stats, and is freed when the gadget goes away. only to be called
+// from the main thread.
+extern void *cmod_alloc(size_t size);
+extern void *cmod_calloc(size_t n, size_t size);
+extern void *cmod_realloc(void *p, size_t size);
+extern void cmod_free(void *p);
+extern char *cmod_strdup(const char *s);
 extern void cmod_err(const char *fmt, ...);
 extern void cmod_info(const char *fmt, ...);
 
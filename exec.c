@@ -0,0 +1,629 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define CONSTATUS_INTERNAL
+#include "constatus.h"
+
+#define min(a, b)			(((a) < (b)) ? (a) : (b))
+
+// anything a command prints beyond this is read and thrown away
+#define EXEC_MAX_OUTPUT			4096
+// how often to check up on a command that has closed its output but not yet
+// exited, or been killed but not yet died
+#define EXEC_REAP_INTERVAL_MS		10
+// helpers that die are restarted with exponential backoff up to this many
+// seconds
+#define EXEC_MAX_BACKOFF_SEC		60
+
+/*
+ * the exec gadget runs a shell command every so often and shows what it
+ * printed. commands are started with posix_spawn(), and their output is
+ * collected through a non-blocking pipe watched by the main loop, so a slow
+ * command only holds up its own gadget. commands that run past their timeout
+ * are killed along with anything they started, and no more than
+ * exec_max_children of them run at once; gadgets that would go over the
+ * limit wait their turn.
+ *
+ * with 'coprocess' set, the command is a helper that is started once and
+ * kept running. every interval it is sent a request line on its standard
+ * input:
+ *
+ *	tick <n>
+ *
+ * and answers on its standard output with a line giving a number of lines,
+ * followed by that many lines to show. it may also send answers on its own
+ * whenever it likes. only one request is ever outstanding: ticks that come
+ * around while the helper is still working on the last one are skipped, and
+ * a helper that takes longer than the timeout to answer is killed. helpers
+ * that exit are restarted, backing off if they keep dying.
+ */
+
+extern char **environ;
+
+struct exec_gadget {
+	struct gadget *gadget;
+	// exec gadgets each get their own module table, since their sizes come
+	// from the config file
+	struct constatus_module module;
+	char *command;
+	struct timespec interval;
+	struct timespec timeout;
+	// the running command; pid is 0 once it has been reaped, and fd -1 once
+	// its output has been closed. pgid stays set until both have happened,
+	// since things the command started may still be around.
+	pid_t pid;
+	pid_t pgid;
+	int fd;
+	int status;
+	int timed_out;
+	struct timespec next_run;
+	struct timespec kill_at;
+	// waiting for another command to finish before starting ours
+	struct list waiting;
+	// helper mode: whether a request has yet to be answered, and when it
+	// was sent; when to next try starting the helper, and how long to wait
+	// after that if it dies again
+	int coprocess;
+	unsigned long seq;
+	int pending;
+	struct timespec sent_at;
+	struct timespec restart_at;
+	int backoff;
+	char output[EXEC_MAX_OUTPUT];
+	size_t output_len;
+	// what is being shown, from the last command that finished
+	char shown[EXEC_MAX_OUTPUT];
+	size_t shown_len;
+};
+
+int exec_max_children = 8;
+static int n_children = 0;
+static struct list waiters = { &waiters, &waiters, };
+
+static void exec_message(struct exec_gadget *ex, enum message_type type,
+			 const char *fmt, ...) {
+	va_list args;
+
+	va_start(args, fmt);
+
+	log_gadget_message(ex->gadget, fmt, fmt, args, type);
+
+	va_end(args);
+}
+
+static inline int time_reached(struct timespec *now, struct timespec *t) {
+	return now->tv_sec > t->tv_sec ||
+	       (now->tv_sec == t->tv_sec && now->tv_nsec >= t->tv_nsec);
+}
+
+static struct timespec time_until(struct timespec *now, struct timespec *t) {
+	struct timespec zero = { .tv_sec = 0, .tv_nsec = 0, };
+
+	return time_reached(now, t) ? zero : timespec_subtract(t, now);
+}
+
+static struct timespec sooner(struct timespec *a, struct timespec *b) {
+	return time_reached(a, b) ? *b : *a;
+}
+
+static void draw_output(struct exec_gadget *ex, WINDOW *win) {
+	const char *line = ex->shown, *end = ex->shown + ex->shown_len;
+	const char *nl;
+	int row;
+
+	werase(win);
+
+	for (row = 0; row < ex->module.height && line < end; ++row) {
+		if (!(nl = memchr(line, '\n', end - line)))
+			nl = end;
+
+		mvwaddnstr(win, row, 0, line, min(nl - line, ex->module.width));
+		line = nl + 1;
+	}
+}
+
+static void exec_display(void *instance, WINDOW *win) {
+	draw_output(instance, win);
+}
+
+// start the command. one-shot commands get a pipe for their output; helpers
+// get a socket for both their input and output, which lets us write to them
+// without risking SIGPIPE.
+static int spawn_command(struct exec_gadget *ex) {
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t mask;
+	char *argv[] = { "/bin/sh", "-c", ex->command, NULL, };
+	int fds[2], e;
+
+	if (ex->coprocess ? socketpair(AF_UNIX, SOCK_STREAM, 0, fds) : pipe(fds))
+		return -1;
+
+	// only our end is non-blocking; the command gets an ordinary one
+	if (fcntl(fds[0], F_SETFD, FD_CLOEXEC) ||
+	    fcntl(fds[1], F_SETFD, FD_CLOEXEC) ||
+	    fcntl(fds[0], F_SETFL, O_NONBLOCK)) {
+		e = errno;
+		goto err_close;
+	}
+
+	if ((e = posix_spawn_file_actions_init(&actions)))
+		goto err_close;
+
+	if ((e = posix_spawnattr_init(&attr)))
+		goto err_actions;
+
+	// the screen belongs to curses, so the command gets neither the
+	// terminal nor our signal handling. it goes in its own process group so
+	// that a timeout can kill anything it starts, too.
+	sigemptyset(&mask);
+	if ((e = ex->coprocess ?
+		 posix_spawn_file_actions_adddup2(&actions, fds[1],
+						  STDIN_FILENO) :
+		 posix_spawn_file_actions_addopen(&actions, STDIN_FILENO,
+						  "/dev/null", O_RDONLY, 0)) ||
+	    (e = posix_spawn_file_actions_adddup2(&actions, fds[1],
+						  STDOUT_FILENO)) ||
+	    (e = posix_spawn_file_actions_addopen(&actions, STDERR_FILENO,
+						  "/dev/null", O_WRONLY, 0)) ||
+	    (e = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP |
+						 POSIX_SPAWN_SETSIGMASK |
+						 POSIX_SPAWN_SETSIGDEF)) ||
+	    (e = posix_spawnattr_setpgroup(&attr, 0)) ||
+	    (e = posix_spawnattr_setsigmask(&attr, &mask)))
+		goto err_attr;
+
+	sigfillset(&mask);
+	if ((e = posix_spawnattr_setsigdefault(&attr, &mask)) ||
+	    (e = posix_spawn(&ex->pid, argv[0], &actions, &attr, argv,
+			     environ)))
+		goto err_attr;
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+	close(fds[1]);
+
+	ex->fd = fds[0];
+	ex->pgid = ex->pid;
+	ex->output_len = 0;
+	ex->timed_out = 0;
+	// helpers are expected to stick around, so they don't count against
+	// the limit
+	if (!ex->coprocess)
+		++n_children;
+
+	return 0;
+
+  err_attr:
+	posix_spawnattr_destroy(&attr);
+  err_actions:
+	posix_spawn_file_actions_destroy(&actions);
+  err_close:
+	close(fds[0]);
+	close(fds[1]);
+	errno = e;
+
+	return -1;
+}
+
+// let the longest waiting gadget start its command
+static void wake_waiter(void) {
+	struct exec_gadget *ex;
+	struct timespec now;
+
+	if (list_is_empty(&waiters) || n_children >= exec_max_children)
+		return;
+
+	ex = list_first(&waiters, struct exec_gadget, waiting);
+	list_del(&ex->waiting);
+	list_init(&ex->waiting);
+
+	if (constatus_gettime(CLOCK_MONOTONIC, &now) == 0)
+		schedule_gadget(ex->gadget, &now);
+}
+
+static void try_reap(struct exec_gadget *ex) {
+	if (!ex->pid || waitpid(ex->pid, &ex->status, WNOHANG) <= 0)
+		return;
+
+	ex->pid = 0;
+	--n_children;
+	wake_waiter();
+}
+
+static void close_output(struct exec_gadget *ex) {
+	unwatch_fd(ex->fd);
+	close(ex->fd);
+	ex->fd = -1;
+}
+
+// the command has exited and its output is closed; show what it printed and
+// wait for the next run
+static void finish_command(struct exec_gadget *ex) {
+	struct gadget *g = ex->gadget;
+
+	ex->pgid = 0;
+
+	if (ex->timed_out) {
+		exec_message(ex, MSGTYPE_ERROR, "command timed out: %s",
+			     ex->command);
+	} else {
+		memcpy(ex->shown, ex->output, ex->output_len);
+		ex->shown_len = ex->output_len;
+
+		if (WIFEXITED(ex->status) && WEXITSTATUS(ex->status))
+			exec_message(ex, MSGTYPE_ERROR,
+				     "command exited with status %d: %s",
+				     WEXITSTATUS(ex->status), ex->command);
+		else if (WIFSIGNALED(ex->status))
+			exec_message(ex, MSGTYPE_ERROR,
+				     "command killed by signal %d: %s",
+				     WTERMSIG(ex->status), ex->command);
+	}
+
+	if (g->window) {
+		draw_output(ex, g->window);
+		note_gadget_drawn(g);
+	}
+
+	schedule_gadget(g, &ex->next_run);
+}
+
+static void check_later(struct exec_gadget *ex) {
+	struct timespec now, delay = {
+		.tv_sec = 0,
+		.tv_nsec = EXEC_REAP_INTERVAL_MS * 1000000,
+	};
+
+	if (constatus_gettime(CLOCK_MONOTONIC, &now) == 0) {
+		now = timespec_add(&now, &delay);
+		schedule_gadget(ex->gadget, &now);
+	}
+}
+
+static void exec_readable(int fd, short revents, void *data) {
+	struct exec_gadget *ex = data;
+	char discard[512];
+	ssize_t s;
+
+	// one read per pass through the main loop, so that a chatty command
+	// can't starve everything else
+	if (ex->output_len < sizeof(ex->output))
+		s = read(fd, ex->output + ex->output_len,
+			 sizeof(ex->output) - ex->output_len);
+	else
+		s = read(fd, discard, sizeof(discard));
+
+	if (s > 0) {
+		if (ex->output_len < sizeof(ex->output))
+			ex->output_len += s;
+		return;
+	}
+
+	if (s < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+
+	close_output(ex);
+	try_reap(ex);
+
+	if (ex->pid)
+		check_later(ex);
+	else
+		finish_command(ex);
+}
+
+/*
+ * helpers
+ */
+
+static void coprocess_died(struct exec_gadget *ex, const char *why) {
+	struct timespec now, backoff = { .tv_sec = ex->backoff, .tv_nsec = 0, };
+	int status = 0;
+
+	close_output(ex);
+	kill(-ex->pgid, SIGKILL);
+	waitpid(ex->pid, &status, 0);
+	ex->pid = ex->pgid = 0;
+	ex->pending = 0;
+
+	if (why)
+		exec_message(ex, MSGTYPE_ERROR,
+			     "helper %s; restarting in %d seconds", why,
+			     ex->backoff);
+	else if (WIFSIGNALED(status))
+		exec_message(ex, MSGTYPE_ERROR,
+			     "helper killed by signal %d; restarting in %d "
+			     "seconds", WTERMSIG(status), ex->backoff);
+	else
+		exec_message(ex, MSGTYPE_ERROR,
+			     "helper exited with status %d; restarting in %d "
+			     "seconds", WEXITSTATUS(status), ex->backoff);
+
+	if (constatus_gettime(CLOCK_MONOTONIC, &now))
+		return;
+
+	ex->restart_at = timespec_add(&now, &backoff);
+	ex->backoff = min(ex->backoff * 2, EXEC_MAX_BACKOFF_SEC);
+	schedule_gadget(ex->gadget, &ex->restart_at);
+}
+
+// pull one answer off the front of the buffer and show it. returns 1 if
+// there was a whole one, 0 if there's more to come, or -1 if it's malformed.
+static int take_answer(struct exec_gadget *ex) {
+	char *end = ex->output + ex->output_len;
+	char *text, *p, *nl;
+	long lines, i;
+	size_t used;
+
+	if (!(nl = memchr(ex->output, '\n', ex->output_len)))
+		goto incomplete;
+
+	errno = 0;
+	lines = strtol(ex->output, &p, 10);
+	if (p != nl || p == ex->output || lines < 0 || errno)
+		return -1;
+
+	text = p = nl + 1;
+	for (i = 0; i < lines; ++i) {
+		if (!(nl = memchr(p, '\n', end - p)))
+			goto incomplete;
+		p = nl + 1;
+	}
+
+	// the last newline isn't part of what's shown
+	ex->shown_len = lines ? p - 1 - text : 0;
+	memcpy(ex->shown, text, ex->shown_len);
+
+	used = p - ex->output;
+	memmove(ex->output, p, ex->output_len - used);
+	ex->output_len -= used;
+
+	return 1;
+
+  incomplete:
+	// an answer has to fit in the buffer
+	return (ex->output_len == sizeof(ex->output)) ? -1 : 0;
+}
+
+static void coprocess_readable(int fd, short revents, void *data) {
+	struct exec_gadget *ex = data;
+	struct gadget *g = ex->gadget;
+	ssize_t s;
+	int r;
+
+	s = read(fd, ex->output + ex->output_len,
+		 sizeof(ex->output) - ex->output_len);
+	if (s < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (s <= 0) {
+		coprocess_died(ex, NULL);
+		return;
+	}
+	ex->output_len += s;
+
+	while ((r = take_answer(ex)) > 0) {
+		ex->pending = 0;
+		ex->backoff = 1;
+
+		if (g->window) {
+			draw_output(ex, g->window);
+			note_gadget_drawn(g);
+		}
+	}
+
+	if (r < 0)
+		coprocess_died(ex, "sent a malformed answer");
+}
+
+static struct timespec coprocess_callback(struct exec_gadget *ex,
+					  struct timespec *now) {
+	struct timespec deadline, left;
+	char request[32];
+	ssize_t s;
+	int len;
+
+	if (!ex->pid) {
+		if (!time_reached(now, &ex->restart_at))
+			return time_until(now, &ex->restart_at);
+
+		if (spawn_command(ex)) {
+			exec_message(ex, MSGTYPE_ERROR,
+				     "error starting helper: %s",
+				     strerror(errno));
+			return ex->interval;
+		}
+
+		if (watch_fd(ex->fd, POLLIN, coprocess_readable, ex)) {
+			coprocess_died(ex, "could not be watched");
+			return time_until(now, &ex->restart_at);
+		}
+
+		ex->output_len = 0;
+		ex->next_run = *now;
+	}
+
+	if (ex->pending) {
+		deadline = timespec_add(&ex->sent_at, &ex->timeout);
+		if (time_reached(now, &deadline)) {
+			coprocess_died(ex, "stopped responding");
+			return time_until(now, &ex->restart_at);
+		}
+
+		left = time_until(now, &deadline);
+		if (!time_reached(now, &ex->next_run)) {
+			deadline = time_until(now, &ex->next_run);
+			return sooner(&left, &deadline);
+		}
+
+		// it's still working on the last request. rather than queue up
+		// requests it can't keep up with, skip this one.
+		++stats.coprocess_ticks_skipped;
+		ex->next_run = timespec_add(now, &ex->interval);
+
+		return sooner(&left, &ex->interval);
+	}
+
+	if (!time_reached(now, &ex->next_run))
+		return time_until(now, &ex->next_run);
+
+	len = snprintf(request, sizeof(request), "tick %lu\n", ++ex->seq);
+	if ((s = send(ex->fd, request, len, MSG_NOSIGNAL)) != len) {
+		// a full socket means it isn't even reading its requests
+		if (s < 0 && errno == EAGAIN)
+			++stats.coprocess_ticks_skipped;
+		else
+			coprocess_died(ex, "could not be written to");
+		return ex->interval;
+	}
+
+	ex->pending = 1;
+	ex->sent_at = *now;
+	ex->next_run = timespec_add(now, &ex->interval);
+
+	return sooner(&ex->timeout, &ex->interval);
+}
+
+static struct timespec exec_callback(void *instance, WINDOW *win) {
+	struct exec_gadget *ex = instance;
+	struct timespec now;
+	struct timespec recheck = {
+		.tv_sec = 0,
+		.tv_nsec = EXEC_REAP_INTERVAL_MS * 1000000,
+	};
+
+	if (constatus_gettime(CLOCK_MONOTONIC, &now)) {
+		exec_message(ex, MSGTYPE_ERROR, "error getting current time");
+		return ex->interval;
+	}
+
+	if (ex->coprocess)
+		return coprocess_callback(ex, &now);
+
+	// still going from last time
+	if (ex->pid || ex->fd >= 0) {
+		try_reap(ex);
+		if (!ex->pid && ex->fd < 0) {
+			finish_command(ex);
+			return time_until(&now, &ex->next_run);
+		}
+
+		if (!time_reached(&now, &ex->kill_at))
+			return time_until(&now, &ex->kill_at);
+
+		// take out anything the command left behind along with it
+		kill(-ex->pgid, SIGKILL);
+		if (ex->pid) {
+			ex->timed_out = 1;
+			return recheck;
+		}
+
+		// the command itself finished, and only something it started
+		// was holding its output open
+		close_output(ex);
+		finish_command(ex);
+		return time_until(&now, &ex->next_run);
+	}
+
+	if (!time_reached(&now, &ex->next_run))
+		return time_until(&now, &ex->next_run);
+
+	if (n_children >= exec_max_children) {
+		// wake_waiter() will get us going again
+		if (list_is_empty(&ex->waiting))
+			list_append(&waiters, &ex->waiting);
+		return ex->interval;
+	}
+
+	if (spawn_command(ex)) {
+		exec_message(ex, MSGTYPE_ERROR, "error running command: %s",
+			     strerror(errno));
+		ex->next_run = timespec_add(&now, &ex->interval);
+		return ex->interval;
+	}
+
+	if (watch_fd(ex->fd, POLLIN, exec_readable, ex)) {
+		exec_message(ex, MSGTYPE_ERROR, "error watching command output");
+		close(ex->fd);
+		ex->fd = -1;
+		kill(-ex->pgid, SIGKILL);
+		ex->timed_out = 1;
+		return recheck;
+	}
+
+	ex->next_run = timespec_add(&now, &ex->interval);
+	ex->kill_at = timespec_add(&now, &ex->timeout);
+
+	return ex->timeout;
+}
+
+// kill the command if it's still running, along with anything it started,
+// and let someone else have its turn
+static void exec_destroy(void *instance) {
+	struct exec_gadget *ex = instance;
+	int status;
+
+	if (ex->fd >= 0)
+		close_output(ex);
+	if (ex->pgid)
+		kill(-ex->pgid, SIGKILL);
+	if (ex->pid) {
+		while (waitpid(ex->pid, &status, 0) < 0 && errno == EINTR)
+			;
+		if (!ex->coprocess)
+			--n_children;
+	}
+
+	list_del(&ex->waiting);
+	free(ex->command);
+	free(ex);
+
+	wake_waiter();
+}
+
+// add an exec gadget running the given command
+int exec_load(const char *name, struct exec_options *opts) {
+	struct exec_gadget *ex;
+	struct gadget *g;
+
+	if (!(ex = calloc(1, sizeof(*ex))))
+		return -1;
+
+	if (!(ex->command = strdup(opts->command)))
+		goto err_free;
+
+	ex->fd = -1;
+	ex->interval = opts->interval;
+	ex->timeout = opts->timeout;
+	ex->coprocess = opts->coprocess;
+	ex->backoff = 1;
+	list_init(&ex->waiting);
+
+	ex->module.height = opts->height;
+	ex->module.width = opts->width;
+	ex->module.callback = exec_callback;
+	ex->module.display = exec_display;
+	ex->module.destroy = exec_destroy;
+
+	if (!(g = new_gadget(&ex->module, name)))
+		goto err_free_command;
+	g->instance = ex;
+	ex->gadget = g;
+
+	return 0;
+
+  err_free_command:
+	free(ex->command);
+  err_free:
+	free(ex);
+
+	return -1;
+}
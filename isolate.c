@@ -0,0 +1,782 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define CONSTATUS_INTERNAL
+#include "constatus.h"
+
+#define min(a, b)			(((a) < (b)) ? (a) : (b))
+
+// the biggest window an isolated gadget can have, in cells
+#define ISO_MAX_CELLS			(1 << 16)
+#define ISO_MAX_TEXT			512
+// how long a host process may take to start up, and to answer a callback,
+// before it's considered hung
+#define ISO_HELLO_TIMEOUT_MS		5000
+#define ISO_CALLBACK_TIMEOUT_SEC	10
+// restarts back off exponentially up to this many seconds
+#define ISO_MAX_BACKOFF_SEC		60
+
+// the host process runs the module, and the main process asks it to do
+// things. every request gets exactly one reply with the same op; the host may
+// also send MESSAGE and RESIZED packets at any time. the main process only has
+// one request out at a time, so that it always knows which frame the host may
+// draw into.
+enum iso_op {
+	ISO_HELLO,	// host -> main: module loaded and initialized
+	ISO_CALLBACK,	// main -> host: run the callback
+	ISO_RESIZE,	// main -> host: the screen changed size
+	ISO_RESIZED,	// host -> main: the module called cmod_resize()
+	ISO_MESSAGE,	// host -> main: something to log
+};
+
+struct iso_request {
+	enum iso_op op;
+	// the frame to draw into, for CALLBACK and RESIZE
+	int frame;
+	int screen_height, screen_width;
+};
+
+struct iso_reply {
+	enum iso_op op;
+	// the frame the host has just drawn into, for CALLBACK and RESIZE
+	int frame;
+	// the module's size for HELLO, the new size for RESIZED
+	int height, width;
+	// the delay returned by the callback, for CALLBACK
+	struct timespec delay;
+	// HELLO only: the module's scheduling hints
+	struct timespec period, phase;
+	enum constatus_align align;
+	int has_resize;
+	// MESSAGE only: the key the message is filed under, then the message,
+	// each NUL-terminated
+	enum message_type type;
+	char text[ISO_MAX_TEXT];
+};
+
+// a window's worth of cells. +1 because winchnstr() NUL-terminates.
+struct iso_frame {
+	int height, width;
+	chtype cells[ISO_MAX_CELLS + 1];
+};
+
+// shared between the main process and the host. each request names the frame
+// the main process isn't looking at, and the host draws into that one, so
+// neither ever sees a half-drawn window. the frame only changes hands when the
+// reply comes back.
+struct iso_shared {
+	struct iso_frame frames[2];
+};
+
+struct isolated_gadget {
+	struct gadget *gadget;
+	char name[_POSIX_PATH_MAX+1];
+	// empty for a built in module
+	char libpath[_POSIX_PATH_MAX+1];
+	// stands in for the module's table in the main process
+	struct constatus_module proxy;
+	struct iso_shared *shared;
+	pid_t pid;
+	// our end of the socket to the host; -1 if it isn't running
+	int fd;
+	int started;
+	int callback_pending;
+	// a request is waiting for its reply; others wait in the queued flags
+	int request_pending;
+	int resize_queued, callback_queued;
+	// the last frame the host finished, or -1
+	int frame;
+	int backoff;
+	struct timespec restart_at;
+};
+
+// set in the host process
+int isolate_host_active = 0;
+static int host_fd = -1;
+static struct iso_shared *host_shared;
+static struct gadget host_gadget;
+
+static int send_packet(int fd, const void *pkt, size_t len) {
+	ssize_t s;
+
+	while ((s = send(fd, pkt, len, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+		;
+
+	return (s < 0) ? -1 : 0;
+}
+
+static size_t reply_len(struct iso_reply *r) {
+	size_t key_len;
+
+	if (r->op != ISO_MESSAGE)
+		return offsetof(struct iso_reply, text);
+
+	key_len = strnlen(r->text, sizeof(r->text) - 1) + 1;
+
+	return offsetof(struct iso_reply, text) + key_len +
+	       strnlen(r->text + key_len, sizeof(r->text) - key_len);
+}
+
+/*
+ * the host process
+ */
+
+static void host_send(struct iso_reply *r) {
+	// if the main process has gone away there's nothing left to do
+	if (send_packet(host_fd, r, reply_len(r)))
+		_exit(EXIT_FAILURE);
+}
+
+void isolate_host_message(const char *key, const char *fmt, va_list args,
+			  enum message_type type) {
+	struct iso_reply r;
+	size_t key_len;
+
+	memset(&r, 0, sizeof(r));
+	r.op = ISO_MESSAGE;
+	r.type = type;
+
+	// keys longer than half the packet are cut short, which can only make
+	// messages look more alike than they are
+	key_len = min(strlen(key), sizeof(r.text) / 2 - 1);
+	memcpy(r.text, key, key_len);
+	vsnprintf(r.text + key_len + 1, sizeof(r.text) - key_len - 1, fmt,
+		  args);
+
+	host_send(&r);
+}
+
+/*
+ * the main process's end of messages
+ */
+
+static void vlog_host_message(struct gadget *g, const char *key,
+			      enum message_type type, const char *fmt,
+			      va_list args) {
+	log_gadget_message(g, key, fmt, args, type);
+}
+
+static void log_host_message(struct gadget *g, const char *key,
+			     enum message_type type, const char *fmt, ...) {
+	va_list args;
+
+	va_start(args, fmt);
+
+	vlog_host_message(g, key, type, fmt, args);
+
+	va_end(args);
+}
+
+// pass a MESSAGE packet on to the message store, attributing it to the gadget
+// (g may still be NULL while the gadget is being loaded)
+static void forward_message(struct gadget *g, const char *name,
+			    struct iso_reply *r, size_t len) {
+	size_t key_len;
+
+	// make sure both strings are terminated, however the packet ended
+	r->text[sizeof(r->text) - 1] = '\0';
+	if (len < offsetof(struct iso_reply, text) + sizeof(r->text))
+		r->text[len - offsetof(struct iso_reply, text)] = '\0';
+	key_len = strlen(r->text);
+	if (key_len + 1 >= sizeof(r->text))
+		return;
+
+	if (g)
+		log_host_message(g, r->text, r->type, "%s", r->text + key_len + 1);
+	else
+		constatus_msg("%s: %s", r->type, name, r->text + key_len + 1);
+}
+
+void isolate_host_resized(struct gadget *g) {
+	struct iso_reply r;
+
+	wresize(g->window, g->height, g->width);
+
+	memset(&r, 0, sizeof(r));
+	r.op = ISO_RESIZED;
+	r.height = g->height;
+	r.width = g->width;
+
+	host_send(&r);
+}
+
+// copy the window into the frame the main process isn't using
+static void host_publish(int frame) {
+	struct iso_frame *f = host_shared->frames + frame;
+	int y, height, width;
+
+	getmaxyx(host_gadget.window, height, width);
+	if (width <= 0)
+		width = 1;
+	if (width > ISO_MAX_CELLS)
+		width = ISO_MAX_CELLS;
+	height = min(height, ISO_MAX_CELLS / width);
+
+	for (y = 0; y < height; ++y)
+		mvwinchnstr(host_gadget.window, y, 0, f->cells + y * width,
+			    width);
+	f->height = height;
+	f->width = width;
+}
+
+// libpath is empty for modules built into the binary, which the host, being
+// a fork of the main process, already has
+static void host_main(const char *name, const char *libpath) {
+	struct constatus_module *module, *copy;
+	const char *why;
+	struct iso_request req;
+	struct iso_reply r;
+	FILE *null_out, *null_in;
+	void *obj;
+	ssize_t s;
+	int null_fd;
+
+	// keep the module off the terminal
+	if ((null_fd = open("/dev/null", O_RDWR)) >= 0) {
+		dup2(null_fd, STDIN_FILENO);
+		dup2(null_fd, STDOUT_FILENO);
+		dup2(null_fd, STDERR_FILENO);
+		if (null_fd > STDERR_FILENO)
+			close(null_fd);
+	}
+
+	// a private curses screen, so the module has windows to draw in. it's
+	// never refreshed.
+	if (!(null_out = fopen("/dev/null", "w")) ||
+	    !(null_in = fopen("/dev/null", "r")) ||
+	    (!newterm(NULL, null_out, null_in) &&
+	     !newterm("vt100", null_out, null_in)))
+		_exit(EXIT_FAILURE);
+
+	if (!*libpath) {
+		if (!(module = find_builtin_module(name))) {
+			constatus_err("no built in module %s", name);
+			_exit(EXIT_FAILURE);
+		}
+	} else {
+		if (!(obj = dlopen(libpath, RTLD_NOW | RTLD_LOCAL))) {
+			constatus_err("error loading module: %s", dlerror());
+			_exit(EXIT_FAILURE);
+		}
+
+		// any copy lasts as long as the host does
+		if (!(module = find_module_table(obj, &copy, &why))) {
+			constatus_err("error loading module: %s", why);
+			_exit(EXIT_FAILURE);
+		}
+	}
+
+	host_gadget.module = module;
+	host_gadget.height = module->height;
+	host_gadget.width = module->width;
+	if (!(host_gadget.window = newpad(module->height > 0 ? module->height : 1,
+					  module->width > 0 ? module->width : 1)))
+		_exit(EXIT_FAILURE);
+
+	pool_init(&host_gadget.pool);
+	set_gadget_context(&host_gadget);
+	host_gadget.instance = module->init();
+	clear_gadget_context();
+	if (!host_gadget.instance)
+		_exit(EXIT_FAILURE);
+
+	memset(&r, 0, sizeof(r));
+	r.op = ISO_HELLO;
+	r.height = host_gadget.height;
+	r.width = host_gadget.width;
+	r.period = module->period;
+	r.phase = module->phase;
+	r.align = module->align;
+	r.has_resize = (module->resize != NULL);
+	host_send(&r);
+
+	while (1) {
+		if ((s = recv(host_fd, &req, sizeof(req), 0)) < 0) {
+			if (errno == EINTR)
+				continue;
+			_exit(EXIT_FAILURE);
+		}
+		// the main process closed its end
+		if (s == 0)
+			_exit(EXIT_SUCCESS);
+		if ((size_t)s < sizeof(req) || req.frame < 0 || req.frame > 1)
+			continue;
+
+		memset(&r, 0, sizeof(r));
+		r.op = req.op;
+
+		set_gadget_context(&host_gadget);
+		switch (req.op) {
+		case ISO_CALLBACK:
+			r.delay = module->callback(host_gadget.instance,
+						   host_gadget.window);
+		break;
+		case ISO_RESIZE:
+			screen_height = req.screen_height;
+			screen_width = req.screen_width;
+			if (module->resize)
+				module->resize(host_gadget.instance,
+					       screen_height, screen_width);
+			werase(host_gadget.window);
+			module->display(host_gadget.instance,
+					host_gadget.window);
+		break;
+		default:
+			clear_gadget_context();
+			continue;
+		}
+		clear_gadget_context();
+
+		host_publish(req.frame);
+		r.frame = req.frame;
+		host_send(&r);
+	}
+}
+
+/*
+ * the main process
+ */
+
+static void host_readable(int fd, short revents, void *data);
+
+static int spawn_host(struct isolated_gadget *iso) {
+	int fds[2];
+	pid_t pid, parent = getpid();
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds))
+		return -1;
+
+	if ((pid = fork()) < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+
+	if (pid == 0) {
+		// if the dashboard goes away, so should we
+		if (prctl(PR_SET_PDEATHSIG, SIGKILL) || getppid() != parent)
+			_exit(EXIT_FAILURE);
+
+		close(fds[0]);
+		isolate_host_active = 1;
+		host_fd = fds[1];
+		host_shared = iso->shared;
+		memset(&host_gadget, 0, sizeof(host_gadget));
+		snprintf(host_gadget.name, sizeof(host_gadget.name), "%s",
+			 iso->name);
+		host_main(iso->name, iso->libpath);
+		_exit(EXIT_FAILURE);
+	}
+
+	close(fds[1]);
+	iso->pid = pid;
+	iso->fd = fds[0];
+	iso->started = 0;
+	iso->callback_pending = 0;
+	iso->request_pending = 0;
+	iso->resize_queued = 0;
+	iso->callback_queued = 0;
+
+	return 0;
+}
+
+// returns 0 once the host has been reaped, with its status in *status
+static int reap_host(pid_t pid, int *status) {
+	pid_t ret;
+
+	while ((ret = waitpid(pid, status, 0)) < 0 && errno == EINTR)
+		;
+
+	return (ret == pid) ? 0 : -1;
+}
+
+// if a request is already out this one waits for its reply. a resize and a
+// callback each need doing at most once, however often they're asked for.
+static void send_request(struct isolated_gadget *iso, enum iso_op op) {
+	struct iso_request req;
+
+	if (iso->request_pending) {
+		if (op == ISO_RESIZE)
+			iso->resize_queued = 1;
+		else
+			iso->callback_queued = 1;
+		return;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.op = op;
+	req.frame = (iso->frame == 0) ? 1 : 0;
+	req.screen_height = screen_height;
+	req.screen_width = screen_width;
+
+	// if this fails the host is gone, and we'll hear about it from poll()
+	send_packet(iso->fd, &req, sizeof(req));
+	iso->request_pending = 1;
+}
+
+// a reply has come back; send whatever was waiting for it
+static void send_queued(struct isolated_gadget *iso) {
+	iso->request_pending = 0;
+
+	if (iso->resize_queued) {
+		iso->resize_queued = 0;
+		send_request(iso, ISO_RESIZE);
+	} else if (iso->callback_queued) {
+		iso->callback_queued = 0;
+		send_request(iso, ISO_CALLBACK);
+	}
+}
+
+static void proxy_display(void *instance, WINDOW *win) {
+	struct isolated_gadget *iso = instance;
+	struct iso_frame *f;
+	int y, height, width, win_height, win_width;
+
+	if (iso->frame >= 0) {
+		f = iso->shared->frames + iso->frame;
+		getmaxyx(win, win_height, win_width);
+		height = min(f->height, win_height);
+		width = min(f->width, win_width);
+
+		for (y = 0; y < height; ++y)
+			mvwaddchnstr(win, y, 0, f->cells + y * f->width, width);
+	}
+
+	if (iso->fd < 0)
+		mvwaddnstr(win, 0, 0, "[restarting]", getmaxx(win));
+}
+
+static void proxy_resize(void *instance, int screen_height, int screen_width) {
+	struct isolated_gadget *iso = instance;
+
+	if (iso->fd >= 0 && iso->started)
+		send_request(iso, ISO_RESIZE);
+}
+
+// never called; isolated callbacks go through isolate_callback()
+static struct timespec proxy_callback(void *instance, WINDOW *win) {
+	struct timespec ret = { .tv_sec = 1, .tv_nsec = 0, };
+
+	return ret;
+}
+
+static void *proxy_init(void) {
+	return NULL;
+}
+
+// the host gets no say in this; it's simply killed
+static void proxy_destroy(void *instance) {
+	struct isolated_gadget *iso = instance;
+	int status;
+
+	if (iso->fd >= 0) {
+		unwatch_fd(iso->fd);
+		close(iso->fd);
+		kill(iso->pid, SIGKILL);
+		reap_host(iso->pid, &status);
+	}
+
+	munmap(iso->shared, sizeof(*iso->shared));
+	free(iso);
+}
+
+static void redraw_gadget(struct gadget *g) {
+	if (!g->window)
+		return;
+
+	proxy_display(g->isolated, g->window);
+	note_gadget_drawn(g);
+}
+
+// clean up after a host process that has exited, or that we've given up on,
+// and arrange for a new one to be started once the backoff has expired
+static void host_died(struct isolated_gadget *iso, const char *why) {
+	struct gadget *g = iso->gadget;
+	int status;
+
+	unwatch_fd(iso->fd);
+	close(iso->fd);
+	iso->fd = -1;
+
+	kill(iso->pid, SIGKILL);
+
+	// if it was reaped elsewhere (ECHILD), there's no status to go by
+	if (reap_host(iso->pid, &status) == 0 && WIFSIGNALED(status) &&
+	    WTERMSIG(status) != SIGKILL)
+		gadget_err(g, "isolated module %s (killed by signal %d)", why,
+			   WTERMSIG(status));
+	else
+		gadget_err(g, "isolated module %s", why);
+
+	iso->backoff = (iso->backoff == 0) ? 1
+		     : min(iso->backoff * 2, ISO_MAX_BACKOFF_SEC);
+	if (constatus_gettime(CLOCK_MONOTONIC, &iso->restart_at) == 0)
+		iso->restart_at.tv_sec += iso->backoff;
+	gadget_info(g, "restarting in %d seconds", iso->backoff);
+
+	schedule_gadget(g, &iso->restart_at);
+	redraw_gadget(g);
+}
+
+// take on what a host says about its module in its HELLO
+static void set_proxy(struct isolated_gadget *iso, struct iso_reply *r) {
+	iso->proxy.height = r->height;
+	iso->proxy.width = r->width;
+	iso->proxy.resize = r->has_resize ? proxy_resize : NULL;
+	iso->proxy.period = r->period;
+	iso->proxy.phase = r->phase;
+	iso->proxy.align = r->align;
+}
+
+// a restarted host, possibly with a new version of the module, has said
+// hello. its window starts out at the module's size again, and its schedule
+// starts over from its next callback, in case the period or phase changed.
+static void hello_changes(struct isolated_gadget *iso, struct iso_reply *r) {
+	struct gadget *g = iso->gadget;
+
+	set_proxy(iso, r);
+	g->deadline.tv_sec = 0;
+	g->deadline.tv_nsec = 0;
+
+	if (r->height != g->height || r->width != g->width) {
+		g->height = r->height;
+		g->width = r->width;
+		place_gadgets();
+		need_redraw = 1;
+	}
+}
+
+static void handle_reply(struct isolated_gadget *iso, struct iso_reply *r,
+			 size_t len) {
+	struct gadget *g = iso->gadget;
+
+	switch (r->op) {
+	case ISO_MESSAGE:
+		forward_message(g, iso->name, r, len);
+	break;
+	case ISO_HELLO:
+		// only a restarted host gets here; the first HELLO is waited
+		// for in isolate_load(). after a reload the module may have
+		// changed, so everything it says is taken on again.
+		iso->started = 1;
+		hello_changes(iso, r);
+		if (iso->proxy.resize)
+			send_request(iso, ISO_RESIZE);
+		send_request(iso, ISO_CALLBACK);
+		iso->callback_pending = 1;
+	break;
+	case ISO_RESIZED:
+		g->height = r->height;
+		g->width = r->width;
+		place_gadgets();
+		need_redraw = 1;
+	break;
+	case ISO_CALLBACK:
+		iso->callback_pending = 0;
+		iso->backoff = 0;
+		iso->frame = r->frame;
+		send_queued(iso);
+		if (g->window)
+			proxy_display(iso, g->window);
+		gadget_callback_done(g, &r->delay);
+	break;
+	case ISO_RESIZE:
+		iso->frame = r->frame;
+		send_queued(iso);
+		redraw_gadget(g);
+	break;
+	}
+
+	if (need_redraw)
+		redraw_screen();
+}
+
+static void host_readable(int fd, short revents, void *data) {
+	struct isolated_gadget *iso = data;
+	struct iso_reply r;
+	ssize_t s;
+
+	while (iso->fd >= 0) {
+		s = recv(iso->fd, &r, sizeof(r), MSG_DONTWAIT);
+
+		if (s < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		if (s < 0 && errno == EINTR)
+			continue;
+		if (s <= 0 || (size_t)s < offsetof(struct iso_reply, text)) {
+			host_died(iso, "exited");
+			return;
+		}
+
+		handle_reply(iso, &r, s);
+	}
+}
+
+// switch to a new version of the module. the host is replaced straight away,
+// and the new one loads it from libpath.
+void isolate_reload(struct gadget *g, const char *libpath) {
+	struct isolated_gadget *iso = g->isolated;
+	int status;
+
+	snprintf(iso->libpath, sizeof(iso->libpath), "%s", libpath);
+
+	if (iso->fd >= 0) {
+		unwatch_fd(iso->fd);
+		close(iso->fd);
+		iso->fd = -1;
+
+		kill(iso->pid, SIGKILL);
+		reap_host(iso->pid, &status);
+	}
+
+	iso->backoff = 0;
+	if (constatus_gettime(CLOCK_MONOTONIC, &iso->restart_at) == 0)
+		schedule_gadget(g, &iso->restart_at);
+}
+
+void isolate_callback(struct gadget *g) {
+	struct isolated_gadget *iso = g->isolated;
+	struct timespec now, timeout, left;
+
+	if (constatus_gettime(CLOCK_MONOTONIC, &now))
+		return;
+
+	timeout = now;
+	timeout.tv_sec += ISO_CALLBACK_TIMEOUT_SEC;
+
+	if (iso->fd < 0) {
+		left = timespec_subtract(&iso->restart_at, &now);
+		if (left.tv_sec > 0 || (left.tv_sec == 0 && left.tv_nsec > 0)) {
+			schedule_gadget(g, &iso->restart_at);
+			return;
+		}
+
+		if (spawn_host(iso)) {
+			gadget_err(g, "cannot restart isolated module: %s",
+				   strerror(errno));
+			iso->restart_at = now;
+			iso->restart_at.tv_sec += ISO_MAX_BACKOFF_SEC;
+			schedule_gadget(g, &iso->restart_at);
+			return;
+		}
+
+		if (watch_fd(iso->fd, POLLIN, host_readable, iso)) {
+			host_died(iso, "could not be watched");
+			return;
+		}
+
+		// the callback goes out once the host says hello
+		schedule_gadget(g, &timeout);
+		return;
+	}
+
+	// this is the watchdog going off
+	if (!iso->started || iso->callback_pending) {
+		host_died(iso, "stopped responding");
+		return;
+	}
+
+	send_request(iso, ISO_CALLBACK);
+	iso->callback_pending = 1;
+	schedule_gadget(g, &timeout);
+}
+
+// wait for a freshly started host to load its module. anything it logs on the
+// way is passed along.
+static int wait_for_hello(struct isolated_gadget *iso, struct iso_reply *r) {
+	struct pollfd pfd = { .fd = iso->fd, .events = POLLIN, };
+	ssize_t s;
+
+	while (1) {
+		if (poll(&pfd, 1, ISO_HELLO_TIMEOUT_MS) <= 0)
+			return -1;
+
+		if ((s = recv(iso->fd, r, sizeof(*r), 0)) <= 0 ||
+		    (size_t)s < offsetof(struct iso_reply, text))
+			return -1;
+
+		if (r->op == ISO_HELLO)
+			return 0;
+
+		if (r->op == ISO_MESSAGE)
+			forward_message(NULL, iso->name, r, s);
+	}
+}
+
+// start an isolated gadget for the module at libpath, or for the built in
+// module of that name if libpath is NULL
+int isolate_load(const char *name, const char *libpath) {
+	struct isolated_gadget *iso;
+	struct iso_reply r;
+	struct gadget *g;
+	int status;
+
+	if (!(iso = calloc(1, sizeof(*iso))))
+		return -1;
+
+	iso->fd = -1;
+	iso->frame = -1;
+	snprintf(iso->name, sizeof(iso->name), "%s", name);
+	snprintf(iso->libpath, sizeof(iso->libpath), "%s",
+		 libpath ? libpath : "");
+
+	if ((iso->shared = mmap(NULL, sizeof(*iso->shared),
+				PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+		goto err_free;
+
+	if (spawn_host(iso))
+		goto err_unmap;
+
+	if (wait_for_hello(iso, &r)) {
+		close(iso->fd);
+		kill(iso->pid, SIGKILL);
+		reap_host(iso->pid, &status);
+		errno = ECHILD;
+		goto err_unmap;
+	}
+	iso->started = 1;
+
+	set_proxy(iso, &r);
+	iso->proxy.init = proxy_init;
+	iso->proxy.callback = proxy_callback;
+	iso->proxy.display = proxy_display;
+	iso->proxy.destroy = proxy_destroy;
+
+	// the watch goes first: once the gadget is in gadgets[], its module
+	// table (the proxy) has to outlive it, so there's no backing out
+	if (watch_fd(iso->fd, POLLIN, host_readable, iso))
+		goto err_kill;
+	if (!(g = new_gadget(&iso->proxy, name)))
+		goto err_unwatch;
+	g->instance = iso;
+	g->isolated = iso;
+	iso->gadget = g;
+
+	return 0;
+
+   err_unwatch:
+	unwatch_fd(iso->fd);
+   err_kill:
+	close(iso->fd);
+	kill(iso->pid, SIGKILL);
+	reap_host(iso->pid, &status);
+   err_unmap:
+	munmap(iso->shared, sizeof(*iso->shared));
+   err_free:
+	free(iso);
+
+	return -1;
+}
@@ -0,0 +1,537 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define CONSTATUS_INTERNAL
+#include "constatus.h"
+
+#define max(a, b)			(((a) > (b)) ? (a) : (b))
+#define min(a, b)			(((a) < (b)) ? (a) : (b))
+
+// how many layouts to remember. resizing back and forth between a couple of
+// sizes (or attaching from a couple of terminals) shouldn't redo the packing
+// every time.
+#define LAYOUT_CACHE_SIZE		4
+
+/*
+ * gadgets are packed onto pages as shelves: rows whose height is set by the
+ * first gadget put on them. every gadget goes on whichever existing shelf it
+ * fits best (the least height wasted, then the least width left over), on
+ * any page. a new shelf is only started when none will do, and a new page
+ * only when no page has room for a new shelf. gadgets are packed tallest
+ * first, which is what keeps the shelves full.
+ *
+ * before that, gadgets pinned to a page (the 'page' setting of their 'load'
+ * entry) go on that page, and gadgets that share a 'group' go on the same
+ * page as each other, if they fit on one. whatever can't be placed as asked
+ * is packed like everything else.
+ */
+
+struct shelf {
+	int y, height;
+	// columns used so far, including the gaps between gadgets
+	int used;
+};
+
+struct layout_page {
+	struct shelf *shelves;
+	int n_shelves;
+	int used_height;
+};
+
+// where a gadget ended up, before centering
+struct placement {
+	int page, shelf, x;
+};
+
+struct layout_state {
+	// the part of the screen gadgets can go in
+	int height, width;
+	struct layout_page *pages;
+	int n_pages, pages_size;
+	// a page can't have more shelves than this
+	int max_shelves;
+	// indexed like the gadgets being laid out
+	struct placement *placed;
+	// for rolling back a page when a group doesn't fit on it
+	struct shelf *scratch;
+};
+
+struct layout_item {
+	int height, width;
+	size_t index;
+};
+
+// a gadget as far as the cache is concerned; any change to these means the
+// layout has to be worked out again
+struct layout_key {
+	struct gadget *gadget;
+	int height, width;
+};
+
+struct layout_result {
+	int page, y, x;
+};
+
+struct layout_cache_entry {
+	int screen_height, screen_width;
+	size_t n;
+	struct layout_key *keys;
+	struct layout_result *results;
+	int n_pages;
+	unsigned long last_used;
+};
+
+static struct layout_cache_entry cache[LAYOUT_CACHE_SIZE];
+static unsigned long cache_clock = 0;
+
+static int add_layout_page(struct layout_state *st) {
+	struct layout_page *page;
+	void *tmp;
+	int size;
+
+	if (st->n_pages == st->pages_size) {
+		size = max(st->pages_size * 2, 4);
+		if (!(tmp = realloc(st->pages, size * sizeof(*st->pages))))
+			return -1;
+		st->pages = tmp;
+		st->pages_size = size;
+	}
+
+	page = &st->pages[st->n_pages];
+	if (!(page->shelves = malloc(st->max_shelves *
+				     sizeof(*page->shelves))))
+		return -1;
+	page->n_shelves = 0;
+	page->used_height = 0;
+
+	return st->n_pages++;
+}
+
+static inline int shelf_next_x(struct shelf *s) {
+	return s->used ? s->used + 1 : 0;
+}
+
+// find the best spot for a gadget on pages first through last. on success,
+// *shelf is either an existing shelf or, if it's equal to the page's
+// n_shelves, a new one.
+static int find_spot(struct layout_state *st, int first, int last,
+		     int height, int width, int *page, int *shelf) {
+	struct shelf *s;
+	int p, i, waste, left, best_waste = 0, best_left = 0;
+	int found = 0;
+
+	for (p = first; p <= last; ++p) {
+		for (i = 0; i < st->pages[p].n_shelves; ++i) {
+			s = &st->pages[p].shelves[i];
+			if (height > s->height ||
+			    shelf_next_x(s) + width > st->width)
+				continue;
+
+			waste = s->height - height;
+			left = st->width - (shelf_next_x(s) + width);
+			if (!found || waste < best_waste ||
+			    (waste == best_waste && left < best_left)) {
+				found = 1;
+				best_waste = waste;
+				best_left = left;
+				*page = p;
+				*shelf = i;
+			}
+		}
+	}
+
+	if (found)
+		return 0;
+
+	for (p = first; p <= last; ++p)
+		if (st->pages[p].used_height + height <= st->height &&
+		    st->pages[p].n_shelves < st->max_shelves) {
+			*page = p;
+			*shelf = st->pages[p].n_shelves;
+			return 0;
+		}
+
+	return -1;
+}
+
+static void put_gadget(struct layout_state *st, size_t i, int page, int shelf,
+		       int height, int width) {
+	struct layout_page *pg = &st->pages[page];
+	struct shelf *s;
+
+	if (shelf == pg->n_shelves) {
+		s = &pg->shelves[pg->n_shelves++];
+		s->y = pg->used_height;
+		s->height = height;
+		s->used = 0;
+		pg->used_height += height;
+	}
+
+	s = &pg->shelves[shelf];
+	st->placed[i].page = page;
+	st->placed[i].shelf = shelf;
+	st->placed[i].x = shelf_next_x(s);
+	s->used = st->placed[i].x + width;
+}
+
+// place a gadget somewhere on pages first through last
+static int place_in(struct layout_state *st, struct layout_item *item,
+		    int first, int last) {
+	int page, shelf;
+
+	if (find_spot(st, first, last, item->height, item->width, &page,
+		      &shelf))
+		return -1;
+
+	put_gadget(st, item->index, page, shelf, item->height, item->width);
+
+	return 0;
+}
+
+// place a gadget anywhere, adding a page if need be
+static int place_anywhere(struct layout_state *st, struct layout_item *item) {
+	int page;
+
+	if (place_in(st, item, 0, st->n_pages - 1) == 0)
+		return 0;
+
+	if ((page = add_layout_page(st)) < 0)
+		return -1;
+
+	return place_in(st, item, page, page);
+}
+
+// try to put every gadget in the group on the given page. if they don't all
+// fit, the page is left as it was.
+static int place_group_on(struct layout_state *st, struct layout_item *group,
+			  size_t n, int page) {
+	struct layout_page saved = st->pages[page];
+	size_t i;
+
+	memcpy(st->scratch, saved.shelves,
+	       saved.n_shelves * sizeof(*saved.shelves));
+
+	for (i = 0; i < n; ++i)
+		if (place_in(st, &group[i], page, page))
+			goto rollback;
+
+	return 0;
+
+  rollback:
+	memcpy(saved.shelves, st->scratch,
+	       saved.n_shelves * sizeof(*saved.shelves));
+	st->pages[page] = saved;
+
+	return -1;
+}
+
+static int place_group(struct layout_state *st, struct layout_item *group,
+		       size_t n) {
+	size_t i;
+	int page;
+
+	for (page = 0; page < st->n_pages; ++page)
+		if (place_group_on(st, group, n, page) == 0)
+			return 0;
+
+	if ((page = add_layout_page(st)) < 0)
+		return -1;
+	if (place_group_on(st, group, n, page) == 0)
+		return 0;
+
+	// too big to share a page; spread it out
+	for (i = 0; i < n; ++i)
+		if (place_anywhere(st, &group[i]))
+			return -1;
+
+	return 0;
+}
+
+// tallest first, then widest first, then in load order
+static int compare_items(const void *a, const void *b) {
+	const struct layout_item *x = a, *y = b;
+
+	if (x->height != y->height)
+		return y->height - x->height;
+	if (x->width != y->width)
+		return y->width - x->width;
+
+	return (x->index > y->index) - (x->index < y->index);
+}
+
+static inline int same_group(struct gadget *a, struct gadget *b) {
+	return a->layout_group && b->layout_group &&
+	       strcmp(a->layout_group, b->layout_group) == 0;
+}
+
+static int pack_gadgets(struct layout_state *st, struct gadget **gadgets,
+			size_t n) {
+	struct layout_item *items, *item;
+	size_t i, j, n_items, n_rest = 0;
+	char *queued;
+	int ret = -1;
+
+	if (!(items = malloc(max(n, 1) * sizeof(*items))))
+		return -1;
+	if (!(queued = calloc(max(n, 1), 1)))
+		goto out_items;
+
+	for (i = 0; i < n; ++i) {
+		if (gadgets[i]->layout_pin <= 0)
+			continue;
+
+		queued[i] = 1;
+		item = &items[0];
+		item->height = gadgets[i]->height;
+		item->width = gadgets[i]->width;
+		item->index = i;
+
+		while (st->n_pages < gadgets[i]->layout_pin)
+			if (add_layout_page(st) < 0)
+				goto out;
+		if (place_in(st, item, gadgets[i]->layout_pin - 1,
+			     gadgets[i]->layout_pin - 1) &&
+		    place_anywhere(st, item))
+			goto out;
+	}
+
+	for (i = 0; i < n; ++i) {
+		if (queued[i] || !gadgets[i]->layout_group)
+			continue;
+
+		n_items = 0;
+		for (j = i; j < n; ++j) {
+			if (queued[j] || !same_group(gadgets[i], gadgets[j]))
+				continue;
+
+			queued[j] = 1;
+			items[n_items].height = gadgets[j]->height;
+			items[n_items].width = gadgets[j]->width;
+			items[n_items].index = j;
+			++n_items;
+		}
+
+		qsort(items, n_items, sizeof(*items), &compare_items);
+		if (place_group(st, items, n_items))
+			goto out;
+	}
+
+	for (i = 0; i < n; ++i) {
+		if (queued[i])
+			continue;
+
+		items[n_rest].height = gadgets[i]->height;
+		items[n_rest].width = gadgets[i]->width;
+		items[n_rest].index = i;
+		++n_rest;
+	}
+
+	qsort(items, n_rest, sizeof(*items), &compare_items);
+	for (i = 0; i < n_rest; ++i)
+		if (place_anywhere(st, &items[i]))
+			goto out;
+
+	ret = 0;
+
+  out:
+	free(queued);
+  out_items:
+	free(items);
+
+	return ret;
+}
+
+// turn placements into screen coordinates, dropping any pages that ended up
+// empty (pins can leave gaps) and centering shelves on their pages and pages
+// on the screen
+static int finish_layout(struct layout_state *st, struct gadget **gadgets,
+			 size_t n, struct layout_result *results) {
+	struct layout_page *pg;
+	struct shelf *s;
+	struct placement *pl;
+	int *renumber;
+	int p, n_pages = 0;
+	size_t i;
+
+	if (!(renumber = malloc(max(st->n_pages, 1) * sizeof(*renumber))))
+		return -1;
+
+	for (p = 0; p < st->n_pages; ++p)
+		renumber[p] = st->pages[p].n_shelves ? n_pages++ : -1;
+
+	for (i = 0; i < n; ++i) {
+		pl = &st->placed[i];
+		pg = &st->pages[pl->page];
+		s = &pg->shelves[pl->shelf];
+
+		results[i].page = renumber[pl->page];
+		// the banner takes up the top line
+		results[i].y = 1 + (st->height - pg->used_height) / 2 + s->y +
+			       (s->height - gadgets[i]->height + 1) / 2;
+		results[i].x = (st->width - s->used) / 2 + pl->x;
+	}
+
+	free(renumber);
+
+	return n_pages;
+}
+
+static void free_layout_state(struct layout_state *st) {
+	int p;
+
+	for (p = 0; p < st->n_pages; ++p)
+		free(st->pages[p].shelves);
+	free(st->pages);
+	free(st->placed);
+	free(st->scratch);
+}
+
+static int compute_layout(struct gadget **gadgets, size_t n,
+			  int screen_height, int screen_width,
+			  struct layout_result *results) {
+	struct layout_state st;
+	size_t i;
+	int ret = -1;
+
+	memset(&st, 0, sizeof(st));
+	st.height = screen_height - 1;
+	st.width = screen_width;
+
+	for (i = 0; i < n; ++i)
+		if (gadgets[i]->height > st.height ||
+		    gadgets[i]->width > st.width) {
+			errno = ERANGE;
+			return -1;
+		}
+
+	st.max_shelves = max(min((size_t)st.height, n), 1);
+	if (!(st.placed = malloc(max(n, 1) * sizeof(*st.placed))) ||
+	    !(st.scratch = malloc(st.max_shelves * sizeof(*st.scratch))))
+		goto out;
+
+	if (pack_gadgets(&st, gadgets, n) == 0)
+		ret = finish_layout(&st, gadgets, n, results);
+
+  out:
+	if (ret < 0 && errno != ERANGE)
+		errno = ENOMEM;
+	free_layout_state(&st);
+
+	return ret;
+}
+
+static struct layout_cache_entry *find_cached_layout(struct gadget **gadgets,
+						     size_t n,
+						     int screen_height,
+						     int screen_width) {
+	struct layout_cache_entry *e;
+	size_t i, j;
+
+	for (i = 0; i < LAYOUT_CACHE_SIZE; ++i) {
+		e = &cache[i];
+		if (!e->keys || e->n != n || e->screen_height != screen_height ||
+		    e->screen_width != screen_width)
+			continue;
+
+		for (j = 0; j < n; ++j)
+			if (e->keys[j].gadget != gadgets[j] ||
+			    e->keys[j].height != gadgets[j]->height ||
+			    e->keys[j].width != gadgets[j]->width)
+				break;
+		if (j == n)
+			return e;
+	}
+
+	return NULL;
+}
+
+static void free_cache_entry(struct layout_cache_entry *e) {
+	free(e->keys);
+	free(e->results);
+	memset(e, 0, sizeof(*e));
+}
+
+// remember a layout, pushing out the least recently used one, which takes
+// ownership of results. returns -1 if it couldn't be remembered.
+static int cache_layout(struct gadget **gadgets, size_t n, int screen_height,
+			 int screen_width, struct layout_result *results,
+			 int n_pages) {
+	struct layout_cache_entry *e = &cache[0];
+	size_t i;
+
+	for (i = 1; i < LAYOUT_CACHE_SIZE; ++i)
+		if (cache[i].last_used < e->last_used)
+			e = &cache[i];
+	free_cache_entry(e);
+
+	if (!(e->keys = malloc(max(n, 1) * sizeof(*e->keys))))
+		return -1;
+
+	for (i = 0; i < n; ++i) {
+		e->keys[i].gadget = gadgets[i];
+		e->keys[i].height = gadgets[i]->height;
+		e->keys[i].width = gadgets[i]->width;
+	}
+	e->results = results;
+	e->n = n;
+	e->screen_height = screen_height;
+	e->screen_width = screen_width;
+	e->n_pages = n_pages;
+	e->last_used = ++cache_clock;
+
+	return 0;
+}
+
+// work out where every gadget goes on a screen of the given size, setting
+// each one's x, y and layout_page. returns the number of pages, or -1 with
+// errno set to ERANGE if a gadget is too big for the screen, or ENOMEM.
+int layout_gadgets(struct gadget **gadgets, size_t n, int screen_height,
+		   int screen_width) {
+	struct layout_cache_entry *e;
+	struct layout_result *results;
+	size_t i;
+	int n_pages, cached = 1;
+
+	if ((e = find_cached_layout(gadgets, n, screen_height, screen_width))) {
+		++stats.layout_cache_hits;
+		e->last_used = ++cache_clock;
+		results = e->results;
+		n_pages = e->n_pages;
+	} else {
+		if (!(results = malloc(max(n, 1) * sizeof(*results)))) {
+			errno = ENOMEM;
+			return -1;
+		}
+
+		if ((n_pages = compute_layout(gadgets, n, screen_height,
+					      screen_width, results)) < 0) {
+			free(results);
+			return -1;
+		}
+		++stats.layouts_computed;
+
+		cached = !cache_layout(gadgets, n, screen_height, screen_width,
+				       results, n_pages);
+	}
+
+	for (i = 0; i < n; ++i) {
+		gadgets[i]->layout_page = results[i].page;
+		gadgets[i]->y = results[i].y;
+		gadgets[i]->x = results[i].x;
+	}
+
+	if (!cached)
+		free(results);
+
+	return n_pages;
+}
+
+// forget every remembered layout. needed whenever gadgets come or go, or
+// their layout hints change, since the cache identifies them by address.
+void layout_forget(void) {
+	size_t i;
+
+	for (i = 0; i < LAYOUT_CACHE_SIZE; ++i)
+		free_cache_entry(&cache[i]);
+}
@@ -0,0 +1,392 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+#define CONSTATUS_INTERNAL
+#include "constatus.h"
+
+#define max(a, b)			(((a) > (b)) ? (a) : (b))
+#define min(a, b)			(((a) < (b)) ? (a) : (b))
+
+// the longest message we'll keep; anything longer is truncated
+#define MESSAGE_MAX_LEN			1024
+// stored messages get at least this much room for their text, so that later
+// repeats with slightly longer arguments still fit
+#define MESSAGE_MIN_SIZE		64
+// the hash table starts this big, and doubles whenever there are more
+// messages than buckets
+#define MESSAGE_HASH_MIN_BUCKETS	64
+
+// how many messages each gadget may log per second, and how many it may log
+// in a burst before it is held to that rate
+struct message_limits message_limits = {
+	.rate = 5,
+	.burst = 20,
+};
+
+// every distinct message, in the order they were first seen
+static struct message **messages = NULL;
+static size_t n_messages = 0;
+static size_t messages_size = 0;
+static struct message **message_hash = NULL;
+static size_t hash_buckets = 0;
+// messages from the core itself, which don't belong to any gadget
+static struct message_bucket core_bucket;
+static size_t message_errors = 0;
+static int error_flag = 0;
+
+static uint32_t hash_key(struct gadget *g, const char *key) {
+	uint32_t hash = 2166136261u;
+	uintptr_t gp = (uintptr_t)g;
+	size_t i;
+
+	for (i = 0; i < sizeof(gp); ++i, gp >>= 8) {
+		hash ^= gp & 0xff;
+		hash *= 16777619u;
+	}
+
+	for (; *key; ++key) {
+		hash ^= (uint8_t)*key;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static struct message *find_message(struct gadget *g, const char *key,
+				    uint32_t hash) {
+	struct message *msg;
+
+	if (!hash_buckets)
+		return NULL;
+
+	for (msg = message_hash[hash % hash_buckets]; msg;
+	     msg = msg->hash_next)
+		if (msg->key_hash == hash && msg->gadget == g &&
+		    strcmp(msg->key, key) == 0)
+			return msg;
+
+	return NULL;
+}
+
+// make sure there's room in the hash table for one more message. the chains
+// are rebuilt from the message list, which already holds everything.
+static int grow_hash(void) {
+	struct message **tmp;
+	size_t i, size, bucket;
+
+	if (n_messages < hash_buckets)
+		return 0;
+
+	size = max(hash_buckets * 2, MESSAGE_HASH_MIN_BUCKETS);
+	if (!(tmp = calloc(size, sizeof(*tmp))))
+		return -1;
+	free(message_hash);
+	message_hash = tmp;
+	hash_buckets = size;
+
+	for (i = 0; i < n_messages; ++i) {
+		if (messages[i]->detached)
+			continue;
+
+		bucket = messages[i]->key_hash % hash_buckets;
+		messages[i]->hash_next = message_hash[bucket];
+		message_hash[bucket] = messages[i];
+	}
+
+	return 0;
+}
+
+static struct message *new_message(struct gadget *g, const char *key,
+				   uint32_t hash, size_t text_len) {
+	struct message *msg;
+	size_t size, key_len = strlen(key);
+	void *tmp;
+
+	if (n_messages == messages_size) {
+		size = max(messages_size * 2, 16);
+		if (!(tmp = realloc(messages, size * sizeof(*messages))))
+			return NULL;
+		messages = tmp;
+		messages_size = size;
+	}
+
+	if (grow_hash())
+		return NULL;
+
+	size = max(text_len + 1, MESSAGE_MIN_SIZE);
+	if (!(msg = malloc(sizeof(*msg) + size + key_len + 1)))
+		return NULL;
+
+	msg->gadget = g;
+	msg->detached = 0;
+	msg->key = msg->text + size;
+	memcpy(msg->key, key, key_len + 1);
+	msg->key_hash = hash;
+	msg->size = size;
+	msg->count = 0;
+
+	msg->hash_next = message_hash[hash % hash_buckets];
+	message_hash[hash % hash_buckets] = msg;
+	messages[n_messages++] = msg;
+	stats.message_bytes += sizeof(*msg) + size + key_len + 1;
+
+	return msg;
+}
+
+// token bucket, done as a virtual schedule: a message may be logged if the
+// bucket's schedule isn't more than a burst ahead of now
+static int take_token(struct message_bucket *b, struct timespec *now) {
+	long long interval, ready, now_nanos, earliest;
+
+	if (message_limits.rate <= 0)
+		return 1;
+
+	interval = 1000000000LL / message_limits.rate;
+	now_nanos = (long long)now->tv_sec * 1000000000 + now->tv_nsec;
+	ready = (long long)b->ready.tv_sec * 1000000000 + b->ready.tv_nsec;
+	earliest = now_nanos - interval * max(message_limits.burst - 1, 0);
+
+	if (ready > now_nanos) {
+		++b->suppressed;
+		++stats.messages_suppressed;
+		return 0;
+	}
+
+	ready = max(ready, earliest) + interval;
+	b->ready.tv_sec = ready / 1000000000;
+	b->ready.tv_nsec = ready % 1000000000;
+
+	return 1;
+}
+
+static int is_power_of_two(unsigned long n) {
+	return n && !(n & (n - 1));
+}
+
+// log a message on behalf of g (or the core, if g is NULL). repeats of the
+// same key from the same gadget are counted against the message that is
+// already stored rather than stored again, and the rate at which each gadget
+// can log is limited. neither repeats nor rate-limited messages allocate
+// anything.
+void log_gadget_message(struct gadget *g, const char *key, const char *fmt,
+			va_list args, enum message_type type) {
+	static char text[MESSAGE_MAX_LEN];
+	struct message_bucket *bucket = g ? &g->message_bucket : &core_bucket;
+	struct message *msg;
+	struct timespec now;
+	va_list args_copy;
+	uint32_t hash;
+	int prefix_len = 0, len;
+	char note[64];
+
+	// in an isolated gadget's host process, messages belong to the parent
+	if (isolate_host_active) {
+		isolate_host_message(key, fmt, args, type);
+		return;
+	}
+
+	if (type == MSGTYPE_ERROR)
+		error_flag = 1;
+
+	if (constatus_gettime(CLOCK_REALTIME, &now)) {
+		++message_errors;
+		return;
+	}
+
+	hash = hash_key(g, key);
+	if ((msg = find_message(g, key, hash))) {
+		++msg->count;
+		msg->time = now;
+		++stats.messages_repeated;
+	}
+
+	// anything over the limit is still counted above, but costs nothing
+	// more than that
+	if (!take_token(bucket, &now))
+		return;
+
+	if (g)
+		prefix_len = snprintf(text, sizeof(text), "%s: ", g->name);
+	va_copy(args_copy, args);
+	len = vsnprintf(text + prefix_len, sizeof(text) - prefix_len, fmt,
+			args_copy);
+	va_end(args_copy);
+	if (len < 0) {
+		++message_errors;
+		return;
+	}
+	len = min(prefix_len + len, (int)sizeof(text) - 1);
+
+	if (!msg) {
+		if (!(msg = new_message(g, key, hash, len))) {
+			++message_errors;
+			return;
+		}
+		msg->count = 1;
+		msg->first = now;
+		msg->time = now;
+	}
+
+	// keep the most recent wording
+	msg->type = type;
+	msg->len = min((size_t)len, msg->size - 1);
+	memcpy(msg->text, text, msg->len);
+	msg->text[msg->len] = '\0';
+
+	// the log gets the first occurrence, and then a reminder every time
+	// the count doubles
+	if (msg->count == 1) {
+		msglog_append(type, &now, msg->text, msg->len);
+	} else if (is_power_of_two(msg->count)) {
+		len = snprintf(note, sizeof(note), " [repeated %lu times]",
+			       msg->count);
+		if (msg->len + len < sizeof(text)) {
+			memcpy(text + msg->len, note, len + 1);
+			msglog_append(type, &now, text, msg->len + len);
+		}
+	}
+}
+
+void log_message(const char *fmt, va_list args, enum message_type type) {
+	log_gadget_message(NULL, fmt, fmt, args, type);
+}
+
+void constatus_vmsg(const char *fmt, va_list args, enum message_type type) {
+	log_message(fmt, args, type);
+}
+
+void constatus_verr(const char *fmt, va_list args) {
+	log_message(fmt, args, MSGTYPE_ERROR);
+}
+
+void constatus_vinfo(const char *fmt, va_list args) {
+	log_message(fmt, args, MSGTYPE_INFO);
+}
+
+void constatus_msg(const char *fmt, enum message_type type, ...) {
+	va_list args;
+
+	va_start(args, type);
+
+	log_message(fmt, args, type);
+
+	va_end(args);
+}
+
+void constatus_err(const char *fmt, ...) {
+	va_list args;
+
+	va_start(args, fmt);
+
+	log_message(fmt, args, MSGTYPE_ERROR);
+
+	va_end(args);
+}
+
+void constatus_info(const char *fmt, ...) {
+	va_list args;
+
+	va_start(args, fmt);
+
+	log_message(fmt, args, MSGTYPE_INFO);
+
+	va_end(args);
+}
+
+// for the core to log something about a gadget. the message is filed under
+// the gadget, which also lends it its name, so the format shouldn't add one.
+void gadget_err(struct gadget *g, const char *fmt, ...) {
+	va_list args;
+
+	va_start(args, fmt);
+
+	log_gadget_message(g, fmt, fmt, args, MSGTYPE_ERROR);
+
+	va_end(args);
+}
+
+void gadget_info(struct gadget *g, const char *fmt, ...) {
+	va_list args;
+
+	va_start(args, fmt);
+
+	log_gadget_message(g, fmt, fmt, args, MSGTYPE_INFO);
+
+	va_end(args);
+}
+
+// g is about to be freed. its messages stay (their text already has its name
+// in it), but are taken out of the hash table, so that nothing is counted
+// against them any more, even by a new gadget at the same address.
+void forget_gadget_messages(struct gadget *g) {
+	struct message **link, *msg;
+	size_t i;
+
+	for (i = 0; i < n_messages; ++i) {
+		if ((msg = messages[i])->gadget != g)
+			continue;
+
+		for (link = message_hash + msg->key_hash % hash_buckets; *link;
+		     link = &(*link)->hash_next)
+			if (*link == msg) {
+				*link = msg->hash_next;
+				break;
+			}
+
+		msg->hash_next = NULL;
+		msg->gadget = NULL;
+		msg->detached = 1;
+	}
+}
+
+// hand every stored message to the persistent log, for when it starts after
+// some have already been logged
+void replay_messages(void) {
+	size_t i;
+
+	for (i = 0; i < n_messages; ++i)
+		msglog_append(messages[i]->type, &messages[i]->first,
+			      messages[i]->text, messages[i]->len);
+}
+
+size_t count_messages(void) {
+	return n_messages;
+}
+
+void print_messages(FILE *fh) {
+	size_t i;
+
+	// [TODO] [XXX] find a better way of conveying these to the user
+	for (i = 0; i < n_messages; ++i) {
+		if (messages[i]->count > 1)
+			fprintf(fh, "%s (repeated %lu times)\n",
+				messages[i]->text, messages[i]->count);
+		else
+			fprintf(fh, "%s\n", messages[i]->text);
+	}
+
+	if (stats.messages_suppressed)
+		fprintf(fh, "%lu messages were dropped by rate limiting\n",
+			stats.messages_suppressed);
+	if (message_errors)
+		fprintf(fh, "%zu messages could not be recorded\n",
+			message_errors);
+}
+
+void free_messages(void) {
+	size_t i;
+
+	for (i = 0; i < n_messages; ++i)
+		free(messages[i]);
+	free(messages);
+
+	messages = NULL;
+	n_messages = messages_size = 0;
+	stats.message_bytes = 0;
+	free(message_hash);
+	message_hash = NULL;
+	hash_buckets = 0;
+}
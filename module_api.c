@@ -1,6 +1,4 @@
 
-#include <string.h>
-#include <stdlib.h>
 
 #define CONSTATUS_INTERNAL
 #include "constatus.h"
@@ -29,6 +27,17 @@ int cmod_resize(int h, int w) {
 	g->height = h;
 	g->width = w;
 
+	// the host process of an isolated gadget has no layout of its own
+	if (isolate_host_active) {
+		isolate_host_resized(g);
+		return 0;
+	}
+
+	// the core is in the middle of telling everyone about a new screen
+	// size, and will lay them all out once it's done
+	if (layout_deferred)
+		return 0;
+
 	place_gadgets();
 
 	need_redraw = 1;
@@ -38,22 +47,9 @@ int cmod_resize(int h, int w) {
 
 static void do_message(struct gadget *g, const char *fmt, va_list args,
 		       enum message_type type) {
-	char *newfmt;
-	size_t newfmt_len;
-
-	newfmt_len = strlen(g->name) + sizeof(": ") + strlen(fmt);
-	if (!(newfmt = malloc(newfmt_len))) {
-		constatus_err("unable to allocate memory for format string");
-		return;
-	}
-
-	// [TODO] [XXX] if g->name has % substitutions in it, constatus_vmsg()
-	// will likely produce incorrect output or crash.
-	snprintf(newfmt, newfmt_len, "%s: %s", g->name, fmt);
-
-	constatus_vmsg(newfmt, args, type);
-
-	free(newfmt);
+	// messages are told apart by their format string, so a gadget
+	// reporting the same problem over and over only gets it stored once
+	log_gadget_message(g, fmt, fmt, args, type);
 }
 
 extern void cmod_err(const char *fmt, ...) {
@@ -81,3 +77,7 @@ void cmod_info(const char *fmt, ...) {
 
 	va_end(args);
 }
+
+int cmod_gettime(clockid_t clock, struct timespec *ts) {
+	return constatus_gettime(clock, ts);
+}
@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "constatus.h"
+#include "cpu_stat.h"
+
+#define min(a, b)			(((a) < (b)) ? (a) : (b))
+#define max(a, b)			(((a) > (b)) ? (a) : (b))
+
+#define CPU_WIDTH			32
+// machines with up to this many cores get a bar per core; bigger ones get a
+// grid with one cell per core
+#define CPU_MAX_BARS			16
+// the cpu lines of /proc/stat come first, so most of the time only the
+// start of it needs reading. this grows if there are more cores than fit.
+#define CPU_INITIAL_BUF_SIZE		4096
+#define CPU_MAX_BUF_SIZE		(1 << 20)
+
+// grid cells, from idle to flat out
+static const char levels[] = " .:-=+*#%@";
+
+struct cpu_ctx {
+	int fd;
+	char *buf;
+	size_t buf_size;
+	// cores that can ever exist, and how many of them are being shown
+	int max_cores;
+	int n_cores;
+	struct cpu_times all, prev_all;
+	struct cpu_times *cores, *prev_cores;
+	// load over the last sample, in tenths of a percent
+	int all_load;
+	int *loads;
+	int cur_height, cur_width;
+	int screen_width;
+	int resize_error;
+	chtype row[CPU_WIDTH];
+};
+
+// how busy something was between two samples, in tenths of a percent.
+// counters that have gone backwards give 0.
+static int load_between(struct cpu_times *prev, struct cpu_times *cur) {
+	unsigned long long busy, total;
+
+	if (cur->total <= prev->total || cur->busy < prev->busy)
+		return 0;
+
+	busy = cur->busy - prev->busy;
+	total = cur->total - prev->total;
+
+	return min(busy * 1000 / total, 1000);
+}
+
+// read /proc/stat and work out how busy everything has been since last time
+static int sample(struct cpu_ctx *ctx) {
+	struct cpu_times *tmp;
+	ssize_t n;
+	void *new_buf;
+	int i, n_cores;
+
+	while (1) {
+		if ((n = pread(ctx->fd, ctx->buf, ctx->buf_size, 0)) < 0) {
+			cmod_err("error reading /proc/stat");
+			return -1;
+		}
+
+		if ((n_cores = cpu_stat_parse(ctx->buf, n, &ctx->all,
+					      ctx->cores,
+					      ctx->max_cores)) >= 0)
+			break;
+
+		if ((size_t)n < ctx->buf_size ||
+		    ctx->buf_size >= CPU_MAX_BUF_SIZE) {
+			cmod_err("cannot make sense of /proc/stat");
+			return -1;
+		}
+
+		if (!(new_buf = cmod_realloc(ctx->buf, ctx->buf_size * 2))) {
+			cmod_err("cannot allocate buffer for /proc/stat");
+			return -1;
+		}
+		ctx->buf = new_buf;
+		ctx->buf_size *= 2;
+	}
+
+	// cores have come or gone, so what was last seen of them may be from
+	// before they went offline. this sample becomes the baseline, and
+	// shows as idle.
+	if (n_cores != ctx->n_cores) {
+		memcpy(ctx->prev_cores, ctx->cores,
+		       n_cores * sizeof(*ctx->cores));
+		ctx->prev_all = ctx->all;
+		ctx->n_cores = n_cores;
+	}
+
+	ctx->all_load = load_between(&ctx->prev_all, &ctx->all);
+	for (i = 0; i < n_cores; ++i)
+		ctx->loads[i] = load_between(ctx->prev_cores + i,
+					     ctx->cores + i);
+
+	ctx->prev_all = ctx->all;
+	tmp = ctx->prev_cores;
+	ctx->prev_cores = ctx->cores;
+	ctx->cores = tmp;
+
+	return 0;
+}
+
+static int wanted_height(struct cpu_ctx *ctx, int width) {
+	if (ctx->n_cores <= CPU_MAX_BARS)
+		return 1 + ctx->n_cores;
+
+	return 1 + (ctx->n_cores + width - 1) / width;
+}
+
+static void *init(void) {
+	struct cpu_ctx *ctx;
+	long n;
+
+	if (!(ctx = cmod_calloc(1, sizeof(*ctx))))
+		return NULL;
+
+	if ((ctx->fd = open("/proc/stat", O_RDONLY | O_CLOEXEC)) < 0) {
+		cmod_err("error opening /proc/stat");
+		goto err_free;
+	}
+
+	n = sysconf(_SC_NPROCESSORS_CONF);
+	ctx->max_cores = max(n, 1);
+	ctx->buf_size = CPU_INITIAL_BUF_SIZE;
+	if (!(ctx->buf = cmod_alloc(ctx->buf_size)) ||
+	    !(ctx->cores = cmod_calloc(ctx->max_cores, sizeof(*ctx->cores))) ||
+	    !(ctx->prev_cores = cmod_calloc(ctx->max_cores,
+					    sizeof(*ctx->prev_cores))) ||
+	    !(ctx->loads = cmod_calloc(ctx->max_cores, sizeof(*ctx->loads)))) {
+		cmod_err("cannot allocate cpu statistics");
+		goto err_close;
+	}
+
+	// the first sample just sets the baseline
+	if (sample(ctx))
+		goto err_close;
+
+	return ctx;
+
+  err_close:
+	close(ctx->fd);
+	cmod_free(ctx->buf);
+	cmod_free(ctx->cores);
+	cmod_free(ctx->prev_cores);
+	cmod_free(ctx->loads);
+  err_free:
+	cmod_free(ctx);
+
+	return NULL;
+}
+
+// the buffers came from cmod_alloc(), so only the file needs closing
+static void destroy(void *instance) {
+	struct cpu_ctx *ctx = instance;
+
+	close(ctx->fd);
+}
+
+// a label and a percentage over a bar showing the same
+static void draw_bar(struct cpu_ctx *ctx, WINDOW *win, int y,
+		     const char *label, int load) {
+	char text[CPU_WIDTH + 1];
+	int i, len, filled;
+
+	len = snprintf(text, sizeof(text), "%-5s%3d%%", label,
+		       (load + 5) / 10);
+	len = min(len, ctx->cur_width);
+	filled = (load * ctx->cur_width + 500) / 1000;
+
+	for (i = 0; i < ctx->cur_width; ++i)
+		ctx->row[i] = ((i < len) ? text[i] : ' ') |
+			      ((i < filled) ? A_REVERSE : 0);
+
+	mvwaddchnstr(win, y, 0, ctx->row, ctx->cur_width);
+}
+
+static void draw_grid(struct cpu_ctx *ctx, WINDOW *win) {
+	int i, j, y = 1, level;
+
+	for (i = 0; i < ctx->n_cores; i += ctx->cur_width, ++y) {
+		for (j = 0; j < ctx->cur_width; ++j) {
+			if (i + j >= ctx->n_cores) {
+				ctx->row[j] = ' ';
+				continue;
+			}
+
+			level = ctx->loads[i + j] * (sizeof(levels) - 2) / 1000;
+			ctx->row[j] = levels[level];
+		}
+
+		mvwaddchnstr(win, y, 0, ctx->row, ctx->cur_width);
+	}
+}
+
+static void display(void *instance, WINDOW *win) {
+	struct cpu_ctx *ctx = instance;
+	char label[16];
+	int i;
+
+	if (ctx->resize_error || ctx->cur_width <= 0) {
+		werase(win);
+		mvwaddnstr(win, 0, 0, "ERROR RESIZE", ctx->cur_width);
+		return;
+	}
+
+	draw_bar(ctx, win, 0, "all", ctx->all_load);
+
+	if (ctx->n_cores > CPU_MAX_BARS) {
+		draw_grid(ctx, win);
+		return;
+	}
+
+	for (i = 0; i < ctx->n_cores; ++i) {
+		snprintf(label, sizeof(label), "%d", i);
+		draw_bar(ctx, win, i + 1, label, ctx->loads[i]);
+	}
+}
+
+// make the gadget the right size for the screen and the number of cores.
+// returns 1 if it was resized, which means the window is about to be
+// replaced.
+static int fit(struct cpu_ctx *ctx) {
+	int width = min(CPU_WIDTH, ctx->screen_width);
+	int height = wanted_height(ctx, width);
+
+	if (height == ctx->cur_height && width == ctx->cur_width)
+		return 0;
+
+	if (cmod_resize(height, width)) {
+		cmod_err("error resizing to fit console");
+		ctx->resize_error = 1;
+		return -1;
+	}
+
+	ctx->cur_height = height;
+	ctx->cur_width = width;
+	ctx->resize_error = 0;
+
+	return 1;
+}
+
+static void resize(void *instance, int screen_height, int screen_width) {
+	struct cpu_ctx *ctx = instance;
+
+	ctx->screen_width = screen_width;
+	ctx->cur_height = ctx->cur_width = 0;
+	fit(ctx);
+}
+
+static struct timespec callback(void *instance, WINDOW *win) {
+	struct cpu_ctx *ctx = instance;
+	struct timespec delay = {
+		.tv_sec = 0,
+		.tv_nsec = 500000000,
+	};
+
+	// cores come and go; if that changes our size, we'll be redrawn
+	if (sample(ctx) == 0 && ctx->screen_width > 0 && fit(ctx) > 0)
+		return delay;
+
+	display(instance, win);
+
+	return delay;
+}
+
+CONSTATUS_MODULE = {
+	.height = 1,
+	.width = CPU_WIDTH,
+	.init = &init,
+	.display = &display,
+	.callback = &callback,
+	.resize = &resize,
+	.destroy = &destroy,
+	.period = { .tv_sec = 0, .tv_nsec = 500000000, },
+};
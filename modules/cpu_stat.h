@@ -0,0 +1,106 @@
+#ifndef _CPU_STAT_H_
+#define _CPU_STAT_H_
+
+#include <stddef.h>
+
+// a parser for the cpu lines at the top of /proc/stat. it is kept separate
+// from the cpu module so that it can be benchmarked on its own. it never
+// allocates, and never looks past the last cpu line.
+
+struct cpu_times {
+	unsigned long long busy;
+	unsigned long long total;
+};
+
+// the columns of a cpu line, in order: user nice system idle iowait irq
+// softirq steal guest guest_nice. guest time is already counted in user and
+// nice, so only the first eight go towards the total.
+#define CPU_STAT_FIELDS			8
+#define CPU_STAT_IDLE			3
+#define CPU_STAT_IOWAIT			4
+
+static inline const char *cpu_stat_number(const char *p, const char *end,
+					  unsigned long long *res) {
+	unsigned long long n = 0;
+
+	while (p < end && *p == ' ')
+		++p;
+	if (p == end || *p < '0' || *p > '9')
+		return NULL;
+
+	while (p < end && *p >= '0' && *p <= '9')
+		n = n * 10 + (*p++ - '0');
+
+	*res = n;
+
+	return p;
+}
+
+// parse one cpu line, which p points just past the "cpu" of. sets *index to
+// the cpu's number, or -1 for the aggregate line. returns a pointer to the
+// start of the next line, or NULL if the line is cut off or malformed.
+static inline const char *cpu_stat_line(const char *p, const char *end,
+					int *index, struct cpu_times *times) {
+	unsigned long long n, idle = 0, total = 0;
+	int i;
+
+	if (p < end && *p >= '0' && *p <= '9') {
+		if (!(p = cpu_stat_number(p, end, &n)))
+			return NULL;
+		*index = n;
+	} else {
+		*index = -1;
+	}
+
+	for (i = 0; i < CPU_STAT_FIELDS; ++i) {
+		if (!(p = cpu_stat_number(p, end, &n)))
+			return NULL;
+
+		total += n;
+		if (i == CPU_STAT_IDLE || i == CPU_STAT_IOWAIT)
+			idle += n;
+	}
+
+	// skip the guest columns, and anything newer kernels have added
+	while (p < end && *p != '\n')
+		++p;
+	if (p == end)
+		return NULL;
+
+	times->total = total;
+	times->busy = total - idle;
+
+	return p + 1;
+}
+
+// parse the cpu lines at the start of buf into *all and cores[0..max_cores).
+// cores that are offline (or numbered max_cores and up) are left alone.
+// returns the number of the highest cpu seen plus one, or -1 if buf ends
+// before the cpu lines do, in which case the caller should read more.
+static inline int cpu_stat_parse(const char *buf, size_t len,
+				 struct cpu_times *all,
+				 struct cpu_times *cores, int max_cores) {
+	const char *p = buf, *end = buf + len;
+	struct cpu_times times;
+	int index, n_cores = 0;
+
+	while (1) {
+		if (end - p < 3)
+			return -1;
+		if (p[0] != 'c' || p[1] != 'p' || p[2] != 'u')
+			return n_cores;
+
+		if (!(p = cpu_stat_line(p + 3, end, &index, &times)))
+			return -1;
+
+		if (index < 0) {
+			*all = times;
+		} else if (index < max_cores) {
+			cores[index] = times;
+			if (index >= n_cores)
+				n_cores = index + 1;
+		}
+	}
+}
+
+#endif /* _CPU_STAT_H_ */
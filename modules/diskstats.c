@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "constatus.h"
+#include "proc_table.h"
+
+#define min(a, b)			(((a) < (b)) ? (a) : (b))
+
+// after the name: reads completed, reads merged, sectors read, time spent
+// reading, writes completed, writes merged, sectors written, ...
+#define DISKSTATS_SECTORS_READ		2
+#define DISKSTATS_SECTORS_WRITTEN	6
+// sectors here are always 512 bytes, whatever the device's are
+#define DISKSTATS_SECTOR_SIZE		512
+
+struct diskstats_ctx {
+	struct proc_table table;
+	int cur_height, cur_width;
+	int screen_width;
+	int resize_error;
+};
+
+static int parse_line(const char *p, const char *end, const char **name,
+		      size_t *name_len, unsigned long long counters[2]) {
+	// major and minor numbers
+	if (!(p = proc_table_skip(p, end, 2)))
+		return -1;
+
+	while (p < end && *p == ' ')
+		++p;
+	*name = p;
+	while (p < end && *p != ' ')
+		++p;
+	*name_len = p - *name;
+	if (!*name_len)
+		return -1;
+
+	if (!(p = proc_table_skip(p, end, DISKSTATS_SECTORS_READ)) ||
+	    !(p = proc_table_number(p, end, &counters[0])) ||
+	    !(p = proc_table_skip(p, end, DISKSTATS_SECTORS_WRITTEN -
+				  DISKSTATS_SECTORS_READ - 1)) ||
+	    !proc_table_number(p, end, &counters[1]))
+		return -1;
+
+	return 0;
+}
+
+// only whole disks, which are the ones in /sys/block; partitions would count
+// everything twice. loop and ram devices are rarely interesting. this is
+// only asked once per device, so it can afford to look at the filesystem.
+static int want(const char *name) {
+	char path[64];
+
+	if (strncmp(name, "loop", 4) == 0 || strncmp(name, "ram", 3) == 0)
+		return 0;
+
+	snprintf(path, sizeof(path), "/sys/block/%s", name);
+
+	return access(path, F_OK) == 0;
+}
+
+static void *init(void) {
+	struct diskstats_ctx *ctx;
+
+	if (!(ctx = cmod_calloc(1, sizeof(*ctx))))
+		return NULL;
+
+	ctx->table.path = "/proc/diskstats";
+	ctx->table.parse_line = &parse_line;
+	ctx->table.want = &want;
+	ctx->table.scale = DISKSTATS_SECTOR_SIZE;
+
+	if (proc_table_open(&ctx->table))
+		goto err_free;
+
+	// the first sample just sets the baseline
+	if (proc_table_sample(&ctx->table))
+		goto err_close;
+	proc_table_pick_rows(&ctx->table);
+
+	return ctx;
+
+  err_close:
+	close(ctx->table.fd);
+	cmod_free(ctx->table.buf);
+	cmod_free(ctx->table.devs);
+  err_free:
+	cmod_free(ctx);
+
+	return NULL;
+}
+
+static void destroy(void *instance) {
+	struct diskstats_ctx *ctx = instance;
+
+	close(ctx->table.fd);
+}
+
+static void display(void *instance, WINDOW *win) {
+	struct diskstats_ctx *ctx = instance;
+
+	if (ctx->resize_error || ctx->cur_width <= 0) {
+		werase(win);
+		mvwaddnstr(win, 0, 0, "ERROR RESIZE", ctx->cur_width);
+		return;
+	}
+
+	proc_table_draw(&ctx->table, win, ctx->cur_width);
+}
+
+// returns 1 if the gadget was resized, which means the window is about to be
+// replaced
+static int fit(struct diskstats_ctx *ctx) {
+	int width = min(PROC_TABLE_WIDTH, ctx->screen_width);
+	int height = proc_table_height(&ctx->table);
+
+	if (height == ctx->cur_height && width == ctx->cur_width)
+		return 0;
+
+	if (cmod_resize(height, width)) {
+		cmod_err("error resizing to fit console");
+		ctx->resize_error = 1;
+		return -1;
+	}
+
+	ctx->cur_height = height;
+	ctx->cur_width = width;
+	ctx->resize_error = 0;
+
+	return 1;
+}
+
+static void resize(void *instance, int screen_height, int screen_width) {
+	struct diskstats_ctx *ctx = instance;
+
+	ctx->screen_width = screen_width;
+	ctx->cur_height = ctx->cur_width = 0;
+	fit(ctx);
+}
+
+static struct timespec callback(void *instance, WINDOW *win) {
+	struct diskstats_ctx *ctx = instance;
+	struct timespec delay = {
+		.tv_sec = 1,
+		.tv_nsec = 0,
+	};
+
+	if (proc_table_sample(&ctx->table) == 0) {
+		proc_table_pick_rows(&ctx->table);
+		// disks come and go; if that changes our size, we'll be
+		// redrawn
+		if (ctx->screen_width > 0 && fit(ctx) > 0)
+			return delay;
+	}
+
+	display(instance, win);
+
+	return delay;
+}
+
+CONSTATUS_MODULE = {
+	.height = 1,
+	.width = PROC_TABLE_WIDTH,
+	.init = &init,
+	.display = &display,
+	.callback = &callback,
+	.resize = &resize,
+	.destroy = &destroy,
+	.period = { .tv_sec = 1, .tv_nsec = 0, },
+};
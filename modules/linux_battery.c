@@ -22,7 +22,7 @@ static void *init() {
 	int i;
 	struct linux_battery_ctx *ctx;
 
-	if (!(ctx = malloc(sizeof(*ctx))))
+	if (!(ctx = cmod_alloc(sizeof(*ctx))))
 		return NULL;
 
 	ctx->n_batts = 0;
@@ -41,7 +41,7 @@ static void *init() {
 	return ctx;
 
    err:
-	free(ctx);
+	cmod_free(ctx);
 
 	return NULL;
 }
@@ -159,7 +159,7 @@ static void resize(void *instance, int screen_height, int screen_width) {
 		goto err;
 	}
 
-	if (!(tmp = realloc(ctx->row, screen_width+1))) {
+	if (!(tmp = cmod_realloc(ctx->row, screen_width+1))) {
 		cmod_err("cannot allocate formatting buffer");
 		goto err;
 	}
@@ -198,4 +198,5 @@ CONSTATUS_MODULE = {
 	.display = &display,
 	.callback = &callback,
 	.resize = &resize,
+	.period = { .tv_sec = 1, .tv_nsec = 0, },
 };
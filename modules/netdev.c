@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "constatus.h"
+#include "proc_table.h"
+
+#define min(a, b)			(((a) < (b)) ? (a) : (b))
+
+// after the colon: rx bytes packets errs drop fifo frame compressed
+// multicast, then tx bytes ...
+#define NETDEV_TX_BYTES			8
+
+struct netdev_ctx {
+	struct proc_table table;
+	int cur_height, cur_width;
+	int screen_width;
+	int resize_error;
+};
+
+static int parse_line(const char *p, const char *end, const char **name,
+		      size_t *name_len, unsigned long long counters[2]) {
+	const char *colon;
+
+	while (p < end && *p == ' ')
+		++p;
+	if (!(colon = memchr(p, ':', end - p)))
+		return -1;
+
+	*name = p;
+	*name_len = colon - p;
+
+	if (!(p = proc_table_number(colon + 1, end, &counters[0])) ||
+	    !(p = proc_table_skip(p, end, NETDEV_TX_BYTES - 1)) ||
+	    !proc_table_number(p, end, &counters[1]))
+		return -1;
+
+	return 0;
+}
+
+static int want(const char *name) {
+	return strcmp(name, "lo") != 0;
+}
+
+static void *init(void) {
+	struct netdev_ctx *ctx;
+
+	if (!(ctx = cmod_calloc(1, sizeof(*ctx))))
+		return NULL;
+
+	ctx->table.path = "/proc/net/dev";
+	ctx->table.skip_lines = 2;
+	ctx->table.parse_line = &parse_line;
+	ctx->table.want = &want;
+	ctx->table.scale = 1;
+
+	if (proc_table_open(&ctx->table))
+		goto err_free;
+
+	// the first sample just sets the baseline
+	if (proc_table_sample(&ctx->table))
+		goto err_close;
+	proc_table_pick_rows(&ctx->table);
+
+	return ctx;
+
+  err_close:
+	close(ctx->table.fd);
+	cmod_free(ctx->table.buf);
+	cmod_free(ctx->table.devs);
+  err_free:
+	cmod_free(ctx);
+
+	return NULL;
+}
+
+// the table itself is freed along with the gadget
+static void destroy(void *instance) {
+	struct netdev_ctx *ctx = instance;
+
+	close(ctx->table.fd);
+}
+
+static void display(void *instance, WINDOW *win) {
+	struct netdev_ctx *ctx = instance;
+
+	if (ctx->resize_error || ctx->cur_width <= 0) {
+		werase(win);
+		mvwaddnstr(win, 0, 0, "ERROR RESIZE", ctx->cur_width);
+		return;
+	}
+
+	proc_table_draw(&ctx->table, win, ctx->cur_width);
+}
+
+// returns 1 if the gadget was resized, which means the window is about to be
+// replaced
+static int fit(struct netdev_ctx *ctx) {
+	int width = min(PROC_TABLE_WIDTH, ctx->screen_width);
+	int height = proc_table_height(&ctx->table);
+
+	if (height == ctx->cur_height && width == ctx->cur_width)
+		return 0;
+
+	if (cmod_resize(height, width)) {
+		cmod_err("error resizing to fit console");
+		ctx->resize_error = 1;
+		return -1;
+	}
+
+	ctx->cur_height = height;
+	ctx->cur_width = width;
+	ctx->resize_error = 0;
+
+	return 1;
+}
+
+static void resize(void *instance, int screen_height, int screen_width) {
+	struct netdev_ctx *ctx = instance;
+
+	ctx->screen_width = screen_width;
+	ctx->cur_height = ctx->cur_width = 0;
+	fit(ctx);
+}
+
+static struct timespec callback(void *instance, WINDOW *win) {
+	struct netdev_ctx *ctx = instance;
+	struct timespec delay = {
+		.tv_sec = 1,
+		.tv_nsec = 0,
+	};
+
+	if (proc_table_sample(&ctx->table) == 0) {
+		proc_table_pick_rows(&ctx->table);
+		// interfaces come and go; if that changes our size, we'll be
+		// redrawn
+		if (ctx->screen_width > 0 && fit(ctx) > 0)
+			return delay;
+	}
+
+	display(instance, win);
+
+	return delay;
+}
+
+CONSTATUS_MODULE = {
+	.height = 1,
+	.width = PROC_TABLE_WIDTH,
+	.init = &init,
+	.display = &display,
+	.callback = &callback,
+	.resize = &resize,
+	.destroy = &destroy,
+	.period = { .tv_sec = 1, .tv_nsec = 0, },
+};
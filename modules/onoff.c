@@ -10,7 +10,7 @@ struct onoff_ctx {
 static void *init(void) {
 	struct onoff_ctx *ret;
 
-	if (!(ret = malloc(sizeof(*ret))))
+	if (!(ret = cmod_alloc(sizeof(*ret))))
 		return NULL;
 
 	ret->is_on = 1;
@@ -44,4 +44,5 @@ CONSTATUS_MODULE = {
 	.init = &init,
 	.callback = &callback,
 	.display = &display,
+	.period = { .tv_sec = 1, .tv_nsec = 0, },
 };
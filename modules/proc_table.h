@@ -0,0 +1,365 @@
+#ifndef _PROC_TABLE_H_
+#define _PROC_TABLE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "constatus.h"
+
+// shared by the modules that show per-device throughput from a /proc file
+// with one line per device (netdev and diskstats).
+//
+// the file is kept open and re-read with pread(), and walked once per
+// sample. devices are remembered in the order they appeared last time, so
+// each line only has to be checked against the device expected at that
+// position; the table is only searched and rebuilt when devices come, go
+// or move. nothing is allocated unless that happens.
+
+#define PROC_TABLE_NAME_SIZE		32
+#define PROC_TABLE_INITIAL_BUF_SIZE	4096
+#define PROC_TABLE_MAX_BUF_SIZE		(1 << 24)
+// how many devices are shown, busiest first
+#define PROC_TABLE_MAX_ROWS		8
+#define PROC_TABLE_WIDTH		22
+
+struct proc_dev {
+	char name[PROC_TABLE_NAME_SIZE];
+	size_t name_len;
+	// two counters per device, e.g. bytes received and sent
+	unsigned long long counters[2];
+	double rates[2];
+	// a slowly decaying high water mark that the bar is scaled against
+	double peak;
+	// -1 if it's new, -2 if it isn't wanted, 0 if it hasn't been sampled
+	// yet, 1 otherwise
+	int seen;
+};
+
+// parse one line: the device's name, and its two counters. returns 0 on
+// success, or -1 if the line doesn't make sense.
+typedef int (*proc_table_line_func)(const char *line, const char *end,
+				    const char **name, size_t *name_len,
+				    unsigned long long counters[2]);
+// whether a device that's just turned up should be shown
+typedef int (*proc_table_want_func)(const char *name);
+
+struct proc_table {
+	const char *path;
+	int fd;
+	char *buf;
+	size_t buf_size;
+	// header lines to skip
+	int skip_lines;
+	proc_table_line_func parse_line;
+	proc_table_want_func want;
+	// how much a unit of the counters is worth, in bytes
+	double scale;
+	struct proc_dev *devs;
+	int n_devs, devs_size;
+	struct timespec last;
+	// scratch for picking the busiest devices
+	int rows[PROC_TABLE_MAX_ROWS];
+	int n_rows;
+	chtype row[PROC_TABLE_WIDTH];
+};
+
+// counters can wrap; 32-bit ones (from 32-bit kernels, and some drivers) do
+// so quite often. a drop is only taken for a wrap if it's a 32-bit counter
+// that has come round by less than half its range: from near the top to
+// somewhere small. any other drop means the counter was reset (the device was
+// replaced, or its driver reloaded), so it starts again from there.
+static inline unsigned long long counter_delta(unsigned long long prev,
+					       unsigned long long cur) {
+	unsigned long long wrapped;
+
+	if (cur >= prev)
+		return cur - prev;
+
+	if (prev <= 0xffffffffULL) {
+		wrapped = cur + (0x100000000ULL - prev);
+		if (wrapped < 0x80000000ULL)
+			return wrapped;
+	}
+
+	return 0;
+}
+
+static inline const char *proc_table_number(const char *p, const char *end,
+					    unsigned long long *res) {
+	unsigned long long n = 0;
+
+	while (p < end && *p == ' ')
+		++p;
+	if (p == end || *p < '0' || *p > '9')
+		return NULL;
+
+	while (p < end && *p >= '0' && *p <= '9')
+		n = n * 10 + (*p++ - '0');
+
+	*res = n;
+
+	return p;
+}
+
+// skip n numbers
+static inline const char *proc_table_skip(const char *p, const char *end,
+					  int n) {
+	unsigned long long ignored;
+
+	while (n-- > 0)
+		if (!(p = proc_table_number(p, end, &ignored)))
+			return NULL;
+
+	return p;
+}
+
+static inline int proc_table_open(struct proc_table *t) {
+	if ((t->fd = open(t->path, O_RDONLY | O_CLOEXEC)) < 0) {
+		cmod_err("error opening %s", t->path);
+		return -1;
+	}
+
+	t->buf_size = PROC_TABLE_INITIAL_BUF_SIZE;
+	if (!(t->buf = cmod_alloc(t->buf_size))) {
+		cmod_err("cannot allocate buffer for %s", t->path);
+		close(t->fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+// read the whole file, growing the buffer if it doesn't fit
+static inline ssize_t proc_table_read(struct proc_table *t) {
+	ssize_t n;
+	void *tmp;
+
+	while ((n = pread(t->fd, t->buf, t->buf_size, 0)) == t->buf_size) {
+		if (t->buf_size >= PROC_TABLE_MAX_BUF_SIZE ||
+		    !(tmp = cmod_realloc(t->buf, t->buf_size * 2))) {
+			cmod_err("cannot allocate buffer for %s", t->path);
+			return -1;
+		}
+		t->buf = tmp;
+		t->buf_size *= 2;
+	}
+
+	if (n < 0)
+		cmod_err("error reading %s", t->path);
+
+	return n;
+}
+
+// find a device that wasn't where it was expected, or add it. slow, but
+// only happens when devices change.
+static inline struct proc_dev *proc_table_find(struct proc_table *t,
+					       int index, const char *name,
+					       size_t name_len) {
+	struct proc_dev tmp;
+	void *new_devs;
+	int i, size;
+
+	for (i = 0; i < t->n_devs; ++i)
+		if (t->devs[i].name_len == name_len &&
+		    memcmp(t->devs[i].name, name, name_len) == 0)
+			break;
+
+	if (i == t->n_devs) {
+		if (name_len >= PROC_TABLE_NAME_SIZE)
+			return NULL;
+
+		if (t->n_devs == t->devs_size) {
+			size = t->devs_size ? t->devs_size * 2 : 16;
+			if (!(new_devs = cmod_realloc(t->devs,
+						      size * sizeof(*t->devs))))
+				return NULL;
+			t->devs = new_devs;
+			t->devs_size = size;
+		}
+
+		memset(&t->devs[i], 0, sizeof(t->devs[i]));
+		memcpy(t->devs[i].name, name, name_len);
+		t->devs[i].name_len = name_len;
+		t->devs[i].seen = -1;
+		++t->n_devs;
+	}
+
+	// move it to where it is in the file, so that it's found straight
+	// away next time
+	tmp = t->devs[i];
+	t->devs[i] = t->devs[index];
+	t->devs[index] = tmp;
+
+	return &t->devs[index];
+}
+
+// take a sample, working out each device's rates since the last one
+static inline int proc_table_sample(struct proc_table *t) {
+	struct timespec now;
+	const char *p, *end, *nl, *name;
+	unsigned long long counters[2];
+	struct proc_dev *dev;
+	size_t name_len;
+	double elapsed;
+	ssize_t n;
+	int i, j, index = 0;
+
+	if ((n = proc_table_read(t)) < 0)
+		return -1;
+
+	cmod_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - t->last.tv_sec) +
+		  (now.tv_nsec - t->last.tv_nsec) / 1e9;
+	t->last = now;
+
+	p = t->buf;
+	end = t->buf + n;
+	for (i = 0; p < end; p = nl + 1, ++i) {
+		if (!(nl = memchr(p, '\n', end - p)))
+			nl = end;
+		if (i < t->skip_lines)
+			continue;
+
+		if (t->parse_line(p, nl, &name, &name_len, counters))
+			continue;
+
+		// the common case: the same device as last time
+		if (index < t->n_devs && t->devs[index].name_len == name_len &&
+		    memcmp(t->devs[index].name, name, name_len) == 0) {
+			dev = &t->devs[index];
+		} else {
+			if (!(dev = proc_table_find(t, index, name, name_len)))
+				continue;
+			if (dev->seen == -1) {
+				// just turned up; decide once whether we
+				// care about it
+				dev->seen = 0;
+				if (!t->want(dev->name))
+					dev->seen = -2;
+			}
+		}
+		++index;
+
+		if (dev->seen == -2)
+			continue;
+
+		for (j = 0; j < 2; ++j) {
+			dev->rates[j] = (!dev->seen || elapsed <= 0) ?
+				0 :
+				counter_delta(dev->counters[j], counters[j]) *
+					t->scale / elapsed;
+			dev->counters[j] = counters[j];
+		}
+		dev->seen = 1;
+
+		dev->peak -= dev->peak / 16;
+		if (dev->rates[0] + dev->rates[1] > dev->peak)
+			dev->peak = dev->rates[0] + dev->rates[1];
+	}
+
+	// anything past the end didn't show up this time
+	t->n_devs = index;
+
+	return 0;
+}
+
+// pick the busiest devices to show, in the order they're listed in the file
+static inline void proc_table_pick_rows(struct proc_table *t) {
+	double rate, least_rate;
+	int i, j, least;
+
+	t->n_rows = 0;
+	for (i = 0; i < t->n_devs; ++i) {
+		if (t->devs[i].seen < 0)
+			continue;
+
+		if (t->n_rows < PROC_TABLE_MAX_ROWS) {
+			t->rows[t->n_rows++] = i;
+			continue;
+		}
+
+		rate = t->devs[i].rates[0] + t->devs[i].rates[1];
+		least = 0;
+		least_rate = -1;
+		for (j = 0; j < t->n_rows; ++j) {
+			if (least_rate < 0 ||
+			    t->devs[t->rows[j]].rates[0] +
+			    t->devs[t->rows[j]].rates[1] < least_rate) {
+				least = j;
+				least_rate = t->devs[t->rows[j]].rates[0] +
+					     t->devs[t->rows[j]].rates[1];
+			}
+		}
+		if (rate <= least_rate)
+			continue;
+
+		memmove(&t->rows[least], &t->rows[least + 1],
+			(t->n_rows - least - 1) * sizeof(t->rows[0]));
+		t->rows[t->n_rows - 1] = i;
+	}
+}
+
+static inline int proc_table_height(struct proc_table *t) {
+	int i, n = 0;
+
+	for (i = 0; i < t->n_devs; ++i)
+		if (t->devs[i].seen >= 0)
+			++n;
+
+	return (n < 1) ? 1 : (n > PROC_TABLE_MAX_ROWS) ? PROC_TABLE_MAX_ROWS : n;
+}
+
+// a rate in bytes per second, in at most five characters
+static inline void proc_table_format_rate(char *dst, size_t n, double rate) {
+	static const char units[] = "BKMGTP";
+	int unit = 0;
+
+	while (rate >= 1000 && unit < (int)sizeof(units) - 2) {
+		rate /= 1024;
+		++unit;
+	}
+
+	if (rate < 10 && unit > 0)
+		snprintf(dst, n, "%.1f%c", rate, units[unit]);
+	else
+		snprintf(dst, n, "%.0f%c", rate, units[unit]);
+}
+
+// one row per device: its name and two rates, over a bar showing how busy
+// it is compared to how busy it's been lately
+static inline void proc_table_draw(struct proc_table *t, WINDOW *win,
+				   int width) {
+	char text[PROC_TABLE_WIDTH + 1], rates[2][16];
+	struct proc_dev *dev;
+	int i, k, len, filled;
+
+	werase(win);
+
+	for (i = 0; i < t->n_rows; ++i) {
+		dev = &t->devs[t->rows[i]];
+		proc_table_format_rate(rates[0], sizeof(rates[0]),
+				       dev->rates[0]);
+		proc_table_format_rate(rates[1], sizeof(rates[1]),
+				       dev->rates[1]);
+
+		len = snprintf(text, sizeof(text), "%-10.10s%6s%6s", dev->name,
+			       rates[0], rates[1]);
+		if (len > width)
+			len = width;
+		filled = (dev->peak > 0) ?
+			(dev->rates[0] + dev->rates[1]) / dev->peak * width + 0.5 :
+			0;
+
+		for (k = 0; k < width; ++k)
+			t->row[k] = ((k < len) ? text[k] : ' ') |
+				    ((k < filled) ? A_REVERSE : 0);
+
+		mvwaddchnstr(win, i, 0, t->row, width);
+	}
+}
+
+#endif /* _PROC_TABLE_H_ */
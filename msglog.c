@@ -0,0 +1,366 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+
+#define CONSTATUS_INTERNAL
+#include "constatus.h"
+
+#define min(a, b)			(((a) < (b)) ? (a) : (b))
+
+// size of the queue between log_message() and the writer thread. must be a
+// power of two.
+#define MSGLOG_RING_SIZE		(1 << 16)
+// the largest amount of formatted output the writer thread collects before
+// issuing a write(2)
+#define MSGLOG_BATCH_SIZE		(1 << 14)
+// longer messages are truncated when they are queued
+#define MSGLOG_MAX_TEXT			(MSGLOG_BATCH_SIZE / 2)
+// how long the writer thread sleeps between batches if nobody pokes it
+#define MSGLOG_FLUSH_INTERVAL_MS	250
+#define MSGLOG_BINARY_MAGIC		0x434c4f47 // "CLOG"
+
+// the header of each record in the queue; the message text (without a
+// terminating NUL) immediately follows it. records may wrap around the end of
+// the ring.
+struct msglog_record {
+	uint32_t len;
+	uint32_t type;
+	int64_t sec;
+	int64_t nsec;
+};
+
+// the on-disk format of a record when log_format is "binary". the message
+// text follows, again with no terminating NUL.
+struct msglog_binary_record {
+	uint32_t magic;
+	uint32_t len;
+	uint32_t type;
+	uint32_t nsec;
+	int64_t sec;
+};
+
+struct msglog_config msglog_config = {
+	.path = NULL,
+	.max_size = 1024 * 1024,
+	.keep = 3,
+	.format = MSGLOG_FORMAT_TEXT,
+};
+
+static uint8_t ring[MSGLOG_RING_SIZE];
+// head is only written by the producer (the main thread), tail only by the
+// writer thread. both count bytes and are never wrapped; index the ring with
+// them modulo MSGLOG_RING_SIZE.
+static _Atomic size_t ring_head = 0;
+static _Atomic size_t ring_tail = 0;
+static _Atomic int writer_stop = 0;
+static _Atomic size_t records_dropped = 0;
+static int wake_fd = -1;
+static int log_fd = -1;
+static off_t log_size = 0;
+static pthread_t writer;
+static int writer_running = 0;
+
+static inline size_t record_span(size_t text_len) {
+	return sizeof(struct msglog_record) + text_len;
+}
+
+static void ring_copy_in(size_t pos, const void *src, size_t n) {
+	size_t off = pos & (MSGLOG_RING_SIZE - 1);
+	size_t first = min(n, MSGLOG_RING_SIZE - off);
+
+	memcpy(ring + off, src, first);
+	memcpy(ring, (const uint8_t *)src + first, n - first);
+}
+
+static void ring_copy_out(size_t pos, void *dst, size_t n) {
+	size_t off = pos & (MSGLOG_RING_SIZE - 1);
+	size_t first = min(n, MSGLOG_RING_SIZE - off);
+
+	memcpy(dst, ring + off, first);
+	memcpy((uint8_t *)dst + first, ring, n - first);
+}
+
+// queue a message for the writer thread. never blocks: if the queue is full
+// the record is dropped and counted, and the writer thread notes the loss in
+// the log the next time it catches up.
+void msglog_append(enum message_type type, struct timespec *time,
+		   const char *text, size_t len) {
+	struct msglog_record rec;
+	size_t head, tail, span, text_len;
+	uint64_t one = 1;
+
+	if (!writer_running)
+		return;
+
+	text_len = min(len, MSGLOG_MAX_TEXT);
+	span = record_span(text_len);
+
+	head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+	tail = atomic_load_explicit(&ring_tail, memory_order_acquire);
+	if (MSGLOG_RING_SIZE - (head - tail) < span) {
+		atomic_fetch_add_explicit(&records_dropped, 1,
+					  memory_order_relaxed);
+		return;
+	}
+
+	rec.len = text_len;
+	rec.type = type;
+	rec.sec = time->tv_sec;
+	rec.nsec = time->tv_nsec;
+	ring_copy_in(head, &rec, sizeof(rec));
+	ring_copy_in(head + sizeof(rec), text, text_len);
+
+	atomic_store_explicit(&ring_head, head + span, memory_order_release);
+
+	// only bother waking the writer early once the queue is getting full;
+	// otherwise it'll get to it at the next flush interval. eventfd writes
+	// never block unless the counter is about to overflow, which it won't.
+	if (head + span - tail > MSGLOG_RING_SIZE / 2)
+		(void)!write(wake_fd, &one, sizeof(one));
+}
+
+static const char *type_name(uint32_t type) {
+	return (type == MSGTYPE_ERROR) ? "error" : "info";
+}
+
+static int write_fully(int fd, const char *buf, size_t n) {
+	ssize_t s;
+
+	while (n > 0) {
+		if ((s = write(fd, buf, n)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += s;
+		n -= s;
+	}
+
+	return 0;
+}
+
+static int open_log(void) {
+	struct stat st;
+
+	if ((log_fd = open(msglog_config.path,
+			   O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+			   0644)) < 0)
+		return -1;
+
+	log_size = (fstat(log_fd, &st) == 0) ? st.st_size : 0;
+
+	return 0;
+}
+
+// shift <path>.N-1 to <path>.N, ..., <path> to <path>.1 and start over with
+// an empty file
+static int rotate_log(void) {
+	char from[_POSIX_PATH_MAX+16], to[_POSIX_PATH_MAX+16];
+	int i;
+
+	close(log_fd);
+	log_fd = -1;
+
+	if (msglog_config.keep <= 0) {
+		unlink(msglog_config.path);
+	} else {
+		for (i = msglog_config.keep - 1; i > 0; --i) {
+			snprintf(from, sizeof(from), "%s.%d",
+				 msglog_config.path, i);
+			snprintf(to, sizeof(to), "%s.%d",
+				 msglog_config.path, i + 1);
+			rename(from, to);
+		}
+		snprintf(to, sizeof(to), "%s.1", msglog_config.path);
+		rename(msglog_config.path, to);
+	}
+
+	return open_log();
+}
+
+static int flush_batch(const char *buf, size_t n) {
+	if (n == 0 || log_fd < 0)
+		return 0;
+
+	if (msglog_config.max_size > 0 && log_size > 0 &&
+	    log_size + n > msglog_config.max_size && rotate_log())
+		return -1;
+
+	if (write_fully(log_fd, buf, n))
+		return -1;
+	log_size += n;
+
+	return 0;
+}
+
+// format one record onto the end of the batch. returns the number of bytes
+// used, or 0 if it doesn't fit.
+static size_t format_record(char *dst, size_t space,
+			    const struct msglog_record *rec, const char *text) {
+	struct msglog_binary_record bin;
+	struct tm tm;
+	time_t sec;
+	size_t n;
+	int len;
+
+	if (msglog_config.format == MSGLOG_FORMAT_BINARY) {
+		n = sizeof(bin) + rec->len;
+		if (n > space)
+			return 0;
+
+		bin.magic = MSGLOG_BINARY_MAGIC;
+		bin.len = rec->len;
+		bin.type = rec->type;
+		bin.nsec = rec->nsec;
+		bin.sec = rec->sec;
+		memcpy(dst, &bin, sizeof(bin));
+		memcpy(dst + sizeof(bin), text, rec->len);
+
+		return n;
+	}
+
+	sec = rec->sec;
+	gmtime_r(&sec, &tm);
+	len = snprintf(dst, space, "%04d-%02d-%02dT%02d:%02d:%02d.%06ldZ %s %.*s\n",
+		       tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+		       tm.tm_hour, tm.tm_min, tm.tm_sec,
+		       (long)(rec->nsec / 1000), type_name(rec->type),
+		       (int)rec->len, text);
+	if (len < 0 || (size_t)len >= space)
+		return 0;
+
+	return len;
+}
+
+// move everything currently in the ring into the log file
+static void drain_ring(void) {
+	static char batch[MSGLOG_BATCH_SIZE];
+	static char text[MSGLOG_MAX_TEXT];
+	struct msglog_record rec;
+	struct timespec now;
+	size_t head, tail, used = 0, n, dropped;
+	char note_text[64];
+
+	tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+	head = atomic_load_explicit(&ring_head, memory_order_acquire);
+
+	while (tail != head) {
+		ring_copy_out(tail, &rec, sizeof(rec));
+		ring_copy_out(tail + sizeof(rec), text, rec.len);
+
+		if (!(n = format_record(batch + used, sizeof(batch) - used,
+					&rec, text))) {
+			flush_batch(batch, used);
+			used = 0;
+			n = format_record(batch, sizeof(batch), &rec, text);
+		}
+		used += n;
+
+		tail += record_span(rec.len);
+		// give the space back as we go, so the producer isn't starved
+		// by a long drain
+		atomic_store_explicit(&ring_tail, tail, memory_order_release);
+	}
+
+	if ((dropped = atomic_exchange_explicit(&records_dropped, 0,
+						memory_order_relaxed))) {
+		// the writer has its own thread, which virtual time doesn't reach
+		clock_gettime(CLOCK_REALTIME, &now);
+		rec.type = MSGTYPE_ERROR;
+		rec.sec = now.tv_sec;
+		rec.nsec = now.tv_nsec;
+		rec.len = snprintf(note_text, sizeof(note_text),
+				   "log queue overflowed; %zu messages lost",
+				   dropped);
+		if (!(n = format_record(batch + used, sizeof(batch) - used,
+					&rec, note_text))) {
+			flush_batch(batch, used);
+			used = 0;
+			n = format_record(batch, sizeof(batch), &rec, note_text);
+		}
+		used += n;
+	}
+
+	flush_batch(batch, used);
+}
+
+static void *writer_main(void *arg) {
+	struct pollfd pfd = { .fd = wake_fd, .events = POLLIN, };
+	uint64_t count;
+
+	while (!atomic_load(&writer_stop)) {
+		if (poll(&pfd, 1, MSGLOG_FLUSH_INTERVAL_MS) > 0)
+			(void)!read(wake_fd, &count, sizeof(count));
+
+		drain_ring();
+	}
+
+	drain_ring();
+
+	return NULL;
+}
+
+// start the writer thread. returns -1 with errno set on failure.
+int msglog_start(void) {
+	sigset_t all, old;
+	int e;
+
+	if (writer_running || !msglog_config.path)
+		return 0;
+
+	if (open_log())
+		return -1;
+
+	if ((wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+		goto err_close_log;
+
+	// signals are the main thread's business
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	e = pthread_create(&writer, NULL, writer_main, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (e) {
+		errno = e;
+		goto err_close_wake;
+	}
+	writer_running = 1;
+
+	return 0;
+
+   err_close_wake:
+	close(wake_fd);
+	wake_fd = -1;
+   err_close_log:
+	close(log_fd);
+	log_fd = -1;
+
+	return -1;
+}
+
+// flush whatever is still queued and stop the writer thread
+void msglog_stop(void) {
+	uint64_t one = 1;
+
+	if (!writer_running)
+		return;
+
+	atomic_store(&writer_stop, 1);
+	(void)!write(wake_fd, &one, sizeof(one));
+	pthread_join(writer, NULL);
+	writer_running = 0;
+
+	close(wake_fd);
+	wake_fd = -1;
+	close(log_fd);
+	log_fd = -1;
+}
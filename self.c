@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#define CONSTATUS_INTERNAL
+#include "constatus.h"
+
+#define SELF_HEIGHT			8
+#define SELF_WIDTH			22
+
+/*
+ * the self gadget shows what constatus itself is costing: its cpu usage and
+ * memory, and how often it wakes up, runs callbacks and sends frames to the
+ * terminal. everything but the first two comes straight from the counters in
+ * stats. the same numbers can be dumped at exit (with --stats) or at any time
+ * by sending SIGUSR1.
+ */
+
+struct self_sample {
+	struct timespec time;
+	// user + system cpu time, in nanoseconds
+	long long cpu;
+	unsigned long wakeups;
+	unsigned long callbacks;
+	unsigned long flushes;
+	unsigned long bytes_written;
+};
+
+struct self_gadget {
+	struct gadget *gadget;
+	int sampled;
+	struct self_sample prev;
+	// what each line showed last, so that redraws don't have to sample
+	// again; empty until there have been two samples
+	char values[SELF_HEIGHT][SELF_WIDTH + 1];
+	chtype row[SELF_WIDTH];
+};
+
+// /proc/self/statm: -1 if it can't be had, -2 if it hasn't been opened yet
+static int statm_fd = -2;
+
+static const struct timespec self_period = { .tv_sec = 1, .tv_nsec = 0, };
+
+static long long cpu_time(struct rusage *ru) {
+	return (ru->ru_utime.tv_sec + ru->ru_stime.tv_sec) * 1000000000LL +
+	       (ru->ru_utime.tv_usec + ru->ru_stime.tv_usec) * 1000LL;
+}
+
+static void take_sample(struct self_sample *s) {
+	struct rusage ru;
+
+	constatus_gettime(CLOCK_MONOTONIC, &s->time);
+	s->cpu = getrusage(RUSAGE_SELF, &ru) ? 0 : cpu_time(&ru);
+	s->wakeups = stats.wakeups;
+	s->callbacks = stats.callbacks;
+	s->flushes = stats.flushes;
+	s->bytes_written = stats.bytes_written;
+}
+
+// resident set size in bytes, or -1 if it isn't known
+long long resident_size(void) {
+	char buf[128];
+	unsigned long long size, resident;
+	ssize_t n;
+
+	if (statm_fd == -2)
+		statm_fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+
+	if (statm_fd < 0 || (n = pread(statm_fd, buf, sizeof(buf) - 1, 0)) <= 0)
+		return -1;
+	buf[n] = '\0';
+
+	if (sscanf(buf, "%llu %llu", &size, &resident) != 2)
+		return -1;
+
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+// a size in at most five characters
+static void format_size(char *dst, size_t n, double size) {
+	static const char units[] = "BKMGT";
+	int unit = 0;
+
+	while (size >= 1000 && unit < (int)sizeof(units) - 2) {
+		size /= 1024;
+		++unit;
+	}
+
+	if (size < 10 && unit > 0)
+		snprintf(dst, n, "%.1f%c", size, units[unit]);
+	else
+		snprintf(dst, n, "%.0f%c", size, units[unit]);
+}
+
+static void draw_line(struct self_gadget *self, WINDOW *win, int y,
+		      const char *label, const char *value) {
+	char text[SELF_WIDTH + 1];
+	int i, len;
+
+	len = snprintf(text, sizeof(text), "%-8s%14s", label, value);
+	if (len > SELF_WIDTH)
+		len = SELF_WIDTH;
+
+	for (i = 0; i < SELF_WIDTH; ++i)
+		self->row[i] = (i < len) ? text[i] : ' ';
+
+	mvwaddchnstr(win, y, 0, self->row, SELF_WIDTH);
+}
+
+static const char *labels[SELF_HEIGHT] = {
+	"cpu", "rss", "wakeups", "calls", "frames", "output", "messages",
+	"input",
+};
+
+// until there have been two samples there are no rates to show
+static void self_display(void *instance, WINDOW *win) {
+	struct self_gadget *self = instance;
+	int i;
+
+	for (i = 0; i < SELF_HEIGHT; ++i)
+		draw_line(self, win, i, labels[i],
+			  self->values[i][0] ? self->values[i] : "-");
+}
+
+static struct timespec self_callback(void *instance, WINDOW *win) {
+	struct self_gadget *self = instance;
+	char (*v)[SELF_WIDTH + 1] = self->values;
+	struct self_sample now;
+	char size[16];
+	long long rss;
+	double elapsed;
+
+	take_sample(&now);
+	if (!self->sampled) {
+		self->sampled = 1;
+		self->prev = now;
+		return self_period;
+	}
+
+	elapsed = (now.time.tv_sec - self->prev.time.tv_sec) +
+		  (now.time.tv_nsec - self->prev.time.tv_nsec) / 1e9;
+	if (elapsed <= 0)
+		return self_period;
+
+	snprintf(v[0], sizeof(v[0]), "%.1f%%",
+		 (now.cpu - self->prev.cpu) / 1e7 / elapsed);
+
+	if ((rss = resident_size()) >= 0)
+		format_size(v[1], sizeof(v[1]), rss);
+	else
+		snprintf(v[1], sizeof(v[1]), "?");
+
+	snprintf(v[2], sizeof(v[2]), "%.1f/s",
+		 (now.wakeups - self->prev.wakeups) / elapsed);
+
+	snprintf(v[3], sizeof(v[3]), "%.1f/s",
+		 (now.callbacks - self->prev.callbacks) / elapsed);
+
+	snprintf(v[4], sizeof(v[4]), "%.1f/s",
+		 (now.flushes - self->prev.flushes) / elapsed);
+
+	format_size(size, sizeof(size),
+		    (now.bytes_written - self->prev.bytes_written) / elapsed);
+	snprintf(v[5], sizeof(v[5]), "%s/s", size);
+
+	format_size(size, sizeof(size), stats.message_bytes);
+	snprintf(v[6], sizeof(v[6]), "%zu/%s", count_messages(), size);
+
+	// the most recent keypress-to-screen time
+	if (stats.input_frames)
+		snprintf(v[7], sizeof(v[7]), "%.1fms",
+			 stats.input_latency / 1000.0);
+	else
+		snprintf(v[7], sizeof(v[7]), "-");
+
+	self->prev = now;
+	self_display(self, win);
+
+	return self_period;
+}
+
+static void self_destroy(void *instance) {
+	free(instance);
+}
+
+static struct constatus_module self_module = {
+	.height = SELF_HEIGHT,
+	.width = SELF_WIDTH,
+	.callback = self_callback,
+	.display = self_display,
+	.destroy = self_destroy,
+	.period = { .tv_sec = 1, .tv_nsec = 0, },
+};
+
+int self_load(const char *name) {
+	struct self_gadget *self;
+	struct gadget *g;
+
+	if (!(self = calloc(1, sizeof(*self))))
+		return -1;
+
+	if (!(g = new_gadget(&self_module, name))) {
+		free(self);
+		return -1;
+	}
+	g->instance = self;
+	self->gadget = g;
+
+	return 0;
+}
+
+// a summary of everything in stats, one item per line
+void print_stats(FILE *fh) {
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) == 0)
+		fprintf(fh, "cpu time: %ld.%03lds user, %ld.%03lds system; "
+			"max rss: %ldK\n",
+			(long)ru.ru_utime.tv_sec, (long)ru.ru_utime.tv_usec / 1000,
+			(long)ru.ru_stime.tv_sec, (long)ru.ru_stime.tv_usec / 1000,
+			ru.ru_maxrss);
+
+	fprintf(fh, "wakeups: %lu; callbacks: %lu; redraws: %lu; "
+		"idle periods: %lu\n",
+		stats.wakeups, stats.callbacks, stats.redraws,
+		stats.idle_periods);
+	fprintf(fh, "input: %lu keys, %lu frames; latency %lu us last, "
+		"%lu us average, %lu us worst\n",
+		stats.keypresses, stats.input_frames, stats.input_latency,
+		stats.input_frames ?
+			stats.input_latency_total / stats.input_frames : 0,
+		stats.input_latency_max);
+	fprintf(fh, "callbacks put off: %lu\n", stats.callback_yields);
+	fprintf(fh, "catching up: %lu suspends, %lu wakeups skipped, "
+		"%lu extra callbacks\n",
+		stats.suspends, stats.catchup_skipped, stats.catchup_calls);
+	fprintf(fh, "frames: %lu flushed, %lu held back; %lu bytes written\n",
+		stats.flushes, stats.flushes_skipped, stats.bytes_written);
+	fprintf(fh, "messages: %zu stored (%lu bytes), %lu repeats, "
+		"%lu dropped\n",
+		count_messages(), stats.message_bytes,
+		stats.messages_repeated, stats.messages_suppressed);
+	fprintf(fh, "layouts: %lu computed, %lu from cache\n",
+		stats.layouts_computed, stats.layout_cache_hits);
+	fprintf(fh, "exec helper ticks skipped: %lu\n",
+		stats.coprocess_ticks_skipped);
+	fprintf(fh, "gadget memory: %lu bytes\n", stats.gadget_bytes);
+	print_gadget_memory(fh);
+}
+
+static void stats_message(const char *key, const char *fmt, ...) {
+	va_list args;
+
+	va_start(args, fmt);
+	log_gadget_message(NULL, key, fmt, args, MSGTYPE_INFO);
+	va_end(args);
+}
+
+// the same, but to the message log, for SIGUSR1. without a log, the dump is
+// kept as a message instead, and shows up at exit.
+void log_stats(void) {
+	struct timespec now;
+	char *buf = NULL, *line, *nl, *colon, key[64];
+	size_t size = 0;
+	FILE *fh;
+
+	if (!(fh = open_memstream(&buf, &size))) {
+		constatus_err("error dumping stats");
+		return;
+	}
+	print_stats(fh);
+	fclose(fh);
+
+	constatus_gettime(CLOCK_REALTIME, &now);
+	for (line = buf; (nl = strchr(line, '\n')); line = nl + 1) {
+		*nl = '\0';
+		if (msglog_config.path) {
+			msglog_append(MSGTYPE_INFO, &now, line, nl - line);
+		} else if ((colon = strchr(line, ':'))) {
+			// one stored message per line, each replaced by the
+			// next dump
+			snprintf(key, sizeof(key), "stats %.*s",
+				 (int)(colon - line), line);
+			stats_message(key, "stats: %s", line);
+		}
+	}
+
+	free(buf);
+}
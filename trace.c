@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CONSTATUS_INTERNAL
+#include "constatus.h"
+
+// how many events the ring holds; once it's full, the oldest are overwritten
+#define TRACE_RING_SIZE			(1 << 16)
+
+/*
+ * tracing records when the core starts and finishes each interesting bit of
+ * work (callbacks, display(), layout, redraws, flushes and keypresses) into
+ * a ring that is allocated up front, so that recording an event costs a
+ * clock_gettime() and a few stores. the ring is written out as Chrome
+ * trace-event JSON at exit, or whenever SIGUSR2 is received, and can be
+ * loaded into chrome://tracing or Perfetto. events are timed by the real
+ * clock even when simulating, so that they show what the work actually cost.
+ */
+
+struct trace_event {
+	long long time;
+	const char *name;
+	// the gadget's name, or NULL for the core
+	const char *gadget;
+	char phase;
+};
+
+int trace_active = 0;
+static const char *trace_path;
+static struct trace_event *ring;
+// total events ever recorded; the ring holds the last TRACE_RING_SIZE
+static unsigned long ring_head;
+static long long trace_epoch;
+// copies of the names of gadgets that have gone away while their events were
+// still in the ring
+struct retired_name {
+	struct retired_name *next;
+	char name[];
+};
+static struct retired_name *retired;
+
+static long long now_nanos(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+int trace_start(const char *path) {
+	if (!(ring = malloc(TRACE_RING_SIZE * sizeof(*ring))))
+		return -1;
+
+	trace_path = path;
+	trace_epoch = now_nanos();
+	ring_head = 0;
+	trace_active = 1;
+
+	return 0;
+}
+
+void trace_event(char phase, const char *name, struct gadget *g) {
+	struct trace_event *ev = &ring[ring_head++ % TRACE_RING_SIZE];
+
+	ev->time = now_nanos();
+	ev->name = name;
+	ev->gadget = g ? g->name : NULL;
+	ev->phase = phase;
+}
+
+// g is going away; point its events at a copy of its name. if there's no
+// memory for one, they're left as core events instead.
+void trace_forget_gadget(struct gadget *g) {
+	struct retired_name *r = NULL;
+	size_t i, len;
+
+	if (!trace_active)
+		return;
+
+	for (i = 0; i < TRACE_RING_SIZE && i < ring_head; ++i) {
+		if (ring[i].gadget != g->name)
+			continue;
+
+		if (!r) {
+			len = strlen(g->name) + 1;
+			if ((r = malloc(sizeof(*r) + len))) {
+				memcpy(r->name, g->name, len);
+				r->next = retired;
+				retired = r;
+			}
+		}
+		ring[i].gadget = r ? r->name : NULL;
+	}
+}
+
+static void write_string(FILE *fh, const char *s) {
+	fputc('"', fh);
+	for (; *s; ++s) {
+		if (*s == '"' || *s == '\\')
+			fprintf(fh, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(fh, "\\u%04x", *s);
+		else
+			fputc(*s, fh);
+	}
+	fputc('"', fh);
+}
+
+// write out what's in the ring. it's written to a temporary file first, so
+// that a viewer never sees half a trace.
+int trace_write(void) {
+	char tmp_path[_POSIX_PATH_MAX+1];
+	struct trace_event *ev;
+	unsigned long i, start;
+	long long rel;
+	int depth = 0, first = 1;
+	pid_t pid = getpid();
+	FILE *fh;
+
+	if (!trace_active)
+		return 0;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", trace_path);
+	if (!(fh = fopen(tmp_path, "w"))) {
+		constatus_err("error opening trace file %s", tmp_path);
+		return -1;
+	}
+
+	fprintf(fh, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+	start = (ring_head > TRACE_RING_SIZE) ? ring_head - TRACE_RING_SIZE : 0;
+	for (i = start; i < ring_head; ++i) {
+		ev = &ring[i % TRACE_RING_SIZE];
+
+		// the ring may have wrapped in the middle of something, which
+		// leaves ends with no beginnings
+		if (ev->phase == 'E' && depth == 0)
+			continue;
+		depth += (ev->phase == 'B') ? 1 : -1;
+
+		rel = ev->time - trace_epoch;
+		fprintf(fh, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\","
+			"\"ts\":%lld.%03lld,\"pid\":%ld,\"tid\":0",
+			first ? "" : ",", ev->name,
+			ev->gadget ? "gadget" : "core", ev->phase,
+			rel / 1000, rel % 1000, (long)pid);
+		if (ev->gadget) {
+			fprintf(fh, ",\"args\":{\"gadget\":");
+			write_string(fh, ev->gadget);
+			fputc('}', fh);
+		}
+		fputc('}', fh);
+		first = 0;
+	}
+
+	fprintf(fh, "\n]}\n");
+
+	if (fclose(fh) == EOF || rename(tmp_path, trace_path)) {
+		constatus_err("error writing trace file %s", trace_path);
+		unlink(tmp_path);
+		return -1;
+	}
+
+	return 0;
+}
+
+void trace_stop(void) {
+	struct retired_name *r;
+
+	trace_active = 0;
+	free(ring);
+	ring = NULL;
+
+	while ((r = retired)) {
+		retired = r->next;
+		free(r);
+	}
+}
@@ -0,0 +1,143 @@
+#include <stdlib.h>
+
+#define CONSTATUS_INTERNAL
+#include "constatus.h"
+
+#define max(a, b)			(((a) > (b)) ? (a) : (b))
+
+// the smallest number of wakeups a heap has room for once it has any
+#define WAKEUP_HEAP_MIN_SIZE		16
+
+/*
+ * a binary min-heap of wakeups, soonest first. it knows nothing of gadgets
+ * beyond carrying a pointer to one, so that it can be exercised on its own
+ * (see bench/core.c).
+ */
+
+static inline int wakeup_sooner(struct wakeup *a, struct wakeup *b) {
+	return timespec_lt(&a->time, &b->time);
+}
+
+static inline size_t parent_index(size_t i) {
+	return (i - 1) / 2;
+}
+
+static inline void wakeup_swap(struct wakeup *a, struct wakeup *b) {
+	struct wakeup tmp;
+
+	tmp = *a;
+	*a = *b;
+	*b = tmp;
+}
+
+int queue_wakeup(struct wakeup_heap *h, struct wakeup *wake) {
+	void *tmp;
+	size_t i;
+	size_t next_size;
+
+	// grow geometrically, so that a heap that's still filling up doesn't
+	// cost a realloc() per wakeup
+	if (h->n == h->size) {
+		next_size = max(h->size * 2, WAKEUP_HEAP_MIN_SIZE);
+		if (!(tmp = realloc(h->wakeups, next_size * sizeof(*h->wakeups))))
+			return -1;
+		h->wakeups = tmp;
+		h->size = next_size;
+	}
+
+	h->wakeups[h->n] = *wake;
+
+	for (i = h->n;
+	     i > 0 && wakeup_sooner(h->wakeups + i,
+				    h->wakeups + parent_index(i));
+	     i = parent_index(i))
+		wakeup_swap(h->wakeups + i, h->wakeups + parent_index(i));
+
+	++h->n;
+
+	return 0;
+}
+
+static inline size_t nth_child(size_t i, size_t child) {
+	return 2 * i + child;
+}
+
+// find the index of child wakeup node in the queue with the soonest wakeup time
+// including the parent node. returns the index of the soonest-to-be-woken
+// child, or i if no child is to be woken sooner than wakups[i].
+static inline size_t find_soonest_child_index(struct wakeup_heap *h,
+					      size_t i) {
+	size_t ret = i;
+	struct timespec soonest_time = h->wakeups[i].time;
+	size_t j;
+
+	for (j = 1; j <= 2; ++j) {
+		if (nth_child(i, j) >= h->n)
+			break;
+
+		if (timespec_lt(&h->wakeups[nth_child(i, j)].time,
+				&soonest_time)) {
+			ret = nth_child(i, j);
+			soonest_time = h->wakeups[nth_child(i, j)].time;
+		}
+	}
+
+	return ret;
+}
+
+// move wakeups[i] down the heap until neither of its children is sooner
+static void sift_down_wakeup(struct wakeup_heap *h, size_t i) {
+	size_t next_i;
+
+	for (; i < h->n; i = next_i) {
+		next_i = find_soonest_child_index(h, i);
+
+		// if we can no longer make forward progress...
+		if (next_i <= i)
+			break;
+
+		wakeup_swap(h->wakeups + i, h->wakeups + next_i);
+	}
+}
+
+int pop_next_wakeup(struct wakeup_heap *h, struct wakeup *res) {
+	if (h->n == 0)
+		return -1;
+
+	*res = h->wakeups[0];
+
+	h->wakeups[0] = h->wakeups[--h->n];
+	sift_down_wakeup(h, 0);
+
+	return 0;
+}
+
+// restore the heap property after wakeup times have been changed in place
+void reheap_wakeups(struct wakeup_heap *h) {
+	size_t i;
+
+	for (i = h->n / 2; i > 0; --i)
+		sift_down_wakeup(h, i - 1);
+}
+
+// drop every wakeup for the given gadget, stale or not, for when it's about to
+// be freed
+void remove_wakeups(struct wakeup_heap *h, struct gadget *g) {
+	size_t i, j;
+
+	for (i = j = 0; i < h->n; ++i)
+		if (h->wakeups[i].gadget != g)
+			h->wakeups[j++] = h->wakeups[i];
+
+	if (j == h->n)
+		return;
+
+	h->n = j;
+	reheap_wakeups(h);
+}
+
+void free_wakeups(struct wakeup_heap *h) {
+	free(h->wakeups);
+	h->wakeups = NULL;
+	h->n = h->size = 0;
+}